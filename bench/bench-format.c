@@ -0,0 +1,323 @@
+/*
+ *  Copyright (C) 2015-2019 Gooroom <gooroom@gooroom.kr>
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+
+/* Micro-benchmarks for the formatting done on every device refresh.
+ *
+ *   bench-format [OUTPUT.json]
+ *
+ * Every case is run over 1, 10 and 500 devices of each device kind,
+ * once for each device state.  Results go to OUTPUT.json, or
+ * to stdout, as ns and allocations per call. */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+#include <glib-object.h>
+
+#include <upower.h>
+
+#include "xfpm-power-common.h"
+
+
+/* Each case runs at least this long, in microseconds */
+#define BENCH_MIN_TIME          (200 * 1000)
+
+static const guint device_counts[] = { 1, 10, 500 };
+
+
+/* Count every allocation, g_malloc () ends up in malloc () as well */
+#ifdef __GLIBC__
+extern void *__libc_malloc  (size_t size);
+extern void *__libc_calloc  (size_t nmemb, size_t size);
+extern void *__libc_realloc (void *ptr, size_t size);
+
+static volatile guint64 n_allocs = 0;
+
+void *
+malloc (size_t size)
+{
+	n_allocs++;
+	return __libc_malloc (size);
+}
+
+void *
+calloc (size_t nmemb, size_t size)
+{
+	n_allocs++;
+	return __libc_calloc (nmemb, size);
+}
+
+void *
+realloc (void *ptr, size_t size)
+{
+	n_allocs++;
+	return __libc_realloc (ptr, size);
+}
+
+#define HAVE_ALLOC_COUNT 1
+#else
+static guint64 n_allocs = 0;
+#endif
+
+
+typedef struct
+{
+	UpDevice           **devices;
+	XfpmDeviceSnapshot  *snapshots;
+	guint               *seconds;
+	guint                n_devices;      /* n_per_kind of each kind */
+	guint                n_per_kind;
+	const gchar         *display_path;
+} BenchData;
+
+typedef void (*BenchFunc) (BenchData *data, guint index);
+
+static GString  *output;
+static gboolean  first_result = TRUE;
+
+
+static void
+bench_get_device_description (BenchData *data, guint index)
+{
+	g_free (get_device_description (data->display_path, data->devices[index]));
+}
+
+static void
+bench_get_device_icon_name (BenchData *data, guint index)
+{
+	g_free (get_device_icon_name (data->devices[index]));
+}
+
+static void
+bench_snapshot_description (BenchData *data, guint index)
+{
+	g_free (xfpm_device_snapshot_get_description (&data->snapshots[index]));
+}
+
+static void
+bench_snapshot_icon_name (BenchData *data, guint index)
+{
+	g_free (xfpm_device_snapshot_get_icon_name (&data->snapshots[index]));
+}
+
+static void
+bench_get_time_string (BenchData *data, guint index)
+{
+	g_free (xfpm_battery_get_time_string (data->seconds[index]));
+}
+
+static void
+bench_translate_device_type (BenchData *data, guint index)
+{
+	/* nothing to free, keep the call from being optimized away */
+	volatile const gchar *type = xfpm_power_translate_device_type (data->snapshots[index].kind);
+	(void) type;
+}
+
+/* @n_per_kind devices of every kind, interleaved, all in @state */
+static void
+bench_data_init (BenchData *data, guint n_per_kind, guint state)
+{
+	guint i;
+
+	data->n_per_kind = n_per_kind;
+	data->n_devices = n_per_kind * UP_DEVICE_KIND_LAST;
+	data->devices = g_new0 (UpDevice *, data->n_devices);
+	data->snapshots = g_new0 (XfpmDeviceSnapshot, data->n_devices);
+	data->seconds = g_new0 (guint, data->n_devices);
+	data->display_path = NULL;
+
+	for (i = 0; i < data->n_devices; i++)
+	{
+		guint kind = i % UP_DEVICE_KIND_LAST;
+		gdouble percentage = 100 - (i * 7) % 100;
+		gchar *model = g_strdup_printf ("Model %u", i);
+
+		/* without a daemon the properties are only stored */
+		data->devices[i] = up_device_new ();
+		g_object_set (data->devices[i],
+		              "kind", kind,
+		              "state", state,
+		              "percentage", percentage,
+		              "time-to-empty", (gint64) (i * 397) % 40000,
+		              "time-to-full", (gint64) (i * 211) % 20000,
+		              "online", (i % 2) == 0,
+		              "vendor", "Vendor",
+		              "model", model,
+		              "icon-name", "battery-good-symbolic",
+		              NULL);
+		g_free (model);
+
+		xfpm_device_snapshot_read (&data->snapshots[i], NULL, data->devices[i]);
+
+		/* from nothing to a bit more than a day */
+		data->seconds[i] = (i * 3613) % 90000;
+	}
+}
+
+static void
+bench_data_clear (BenchData *data)
+{
+	guint i;
+
+	for (i = 0; i < data->n_devices; i++)
+		g_object_unref (data->devices[i]);
+
+	g_free (data->devices);
+	g_free (data->snapshots);
+	g_free (data->seconds);
+}
+
+/* Names come from libupower-glib, so quote them properly */
+static void
+append_json_string (GString *string, const gchar *value)
+{
+	const gchar *p;
+
+	g_string_append_c (string, '"');
+
+	for (p = value; *p != '\0'; p++)
+	{
+		if (*p == '"' || *p == '\\')
+			g_string_append_printf (string, "\\%c", *p);
+		else if ((guchar) *p < 0x20)
+			g_string_append_printf (string, "\\u%04x", (guint) *p);
+		else
+			g_string_append_c (string, *p);
+	}
+
+	g_string_append_c (string, '"');
+}
+
+static void
+bench_run (const gchar *name, BenchFunc func, BenchData *data, const gchar *state)
+{
+	guint64 rounds = 1, r, n_ops, allocs_before;
+	gint64 start, elapsed;
+	guint i;
+
+	/* warm up, interned strings and translations are looked up once */
+	for (i = 0; i < data->n_devices; i++)
+		func (data, i);
+
+	/* double the rounds until a run takes long enough */
+	for (;;)
+	{
+		allocs_before = n_allocs;
+		start = g_get_monotonic_time ();
+
+		for (r = 0; r < rounds; r++)
+			for (i = 0; i < data->n_devices; i++)
+				func (data, i);
+
+		elapsed = g_get_monotonic_time () - start;
+		if (elapsed >= BENCH_MIN_TIME)
+			break;
+
+		rounds *= 2;
+	}
+
+	n_ops = rounds * data->n_devices;
+
+	g_string_append_printf (output, "%s\n    { \"name\": ", first_result ? "" : ",");
+	append_json_string (output, name);
+	g_string_append_printf (output, ", \"devices\": %u, \"kinds\": %u, \"state\": ",
+	                        data->n_per_kind, UP_DEVICE_KIND_LAST);
+	append_json_string (output, state);
+	g_string_append_printf (output,
+	                        ", \"iterations\": %" G_GUINT64_FORMAT ", \"ns_per_op\": %.1f, ",
+	                        n_ops, (gdouble) elapsed * 1000 / n_ops);
+
+#ifdef HAVE_ALLOC_COUNT
+	g_string_append_printf (output, "\"allocs_per_op\": %.2f }",
+	                        (gdouble) (n_allocs - allocs_before) / n_ops);
+#else
+	g_string_append (output, "\"allocs_per_op\": null }");
+#endif
+
+	first_result = FALSE;
+
+	fprintf (stderr, "%-28s %4u x %u devices  %-18s %10.1f ns/op\n",
+	         name, data->n_per_kind, UP_DEVICE_KIND_LAST, state, (gdouble) elapsed * 1000 / n_ops);
+}
+
+int
+main (int argc, char **argv)
+{
+	BenchData data;
+	guint n, state;
+
+	/* every allocation should go through malloc () */
+	g_setenv ("G_SLICE", "always-malloc", TRUE);
+
+	output = g_string_new ("{\n  \"benchmarks\": [");
+
+	for (n = 0; n < G_N_ELEMENTS (device_counts); n++)
+	{
+		for (state = 0; state < UP_DEVICE_STATE_LAST; state++)
+		{
+			const gchar *state_name = up_device_state_to_string (state);
+
+			bench_data_init (&data, device_counts[n], state);
+
+			bench_run ("get_device_description", bench_get_device_description, &data, state_name);
+			bench_run ("get_device_icon_name", bench_get_device_icon_name, &data, state_name);
+			bench_run ("snapshot_get_description", bench_snapshot_description, &data, state_name);
+			bench_run ("snapshot_get_icon_name", bench_snapshot_icon_name, &data, state_name);
+
+			bench_data_clear (&data);
+		}
+
+		/* neither depends on the state */
+		bench_data_init (&data, device_counts[n], UP_DEVICE_STATE_UNKNOWN);
+
+		bench_run ("xfpm_battery_get_time_string", bench_get_time_string, &data, "any");
+		bench_run ("xfpm_power_translate_device_type", bench_translate_device_type, &data, "any");
+
+		bench_data_clear (&data);
+	}
+
+	g_string_append (output, "\n  ]\n}\n");
+
+	if (argc > 1)
+	{
+		GError *error = NULL;
+
+		if (!g_file_set_contents (argv[1], output->str, output->len, &error))
+		{
+			fprintf (stderr, "Unable to write %s: %s\n", argv[1], error->message);
+			g_error_free (error);
+			return EXIT_FAILURE;
+		}
+	}
+	else
+	{
+		fputs (output->str, stdout);
+	}
+
+	g_string_free (output, TRUE);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,933 @@
+/*
+ *  Copyright (C) 2015-2019 Gooroom <gooroom@gooroom.kr>
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+
+/* End-to-end latency from UPower to the tray.
+ *
+ *   bench-upower [OUTPUT.json]
+ *
+ * Starts a private bus, puts a scripted org.freedesktop.UPower on it
+ * (this same program, run with --fake-upower) and points each of the
+ * plugin's UPower backends, libupower-glib and plain GDBus, and the model
+ * at it in turn.  The fake then changes its batteries,
+ * and with each of them the display device, at a fixed rate or as fast
+ * as it can.  For every change that reaches the listener the time since
+ * the fake emitted PropertiesChanged is recorded; the tray update also
+ * includes looking up the icon name and description, as the plugin
+ * does.  Both clocks are CLOCK_MONOTONIC so the two processes agree.
+ *
+ * Results go to OUTPUT.json, or to stdout, as p50/p99 latency and CPU
+ * time of this process per emitted change. */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include <glib.h>
+#include <glib-unix.h>
+#include <gio/gio.h>
+
+#include "xfpm-power-common.h"
+#include "battery-backend.h"
+#include "battery-upower.h"
+#include "battery-dbus.h"
+#include "battery-model.h"
+
+
+#define FAKE_DISPLAY_PATH       UPOWER_PATH_DEVICE "DisplayDevice"
+#define FAKE_BATTERY_PATH       UPOWER_PATH_DEVICE "battery_BAT%u"
+
+/* How long to wait for late updates after the last change was sent */
+#define SETTLE_TIME             500
+
+static const guint device_counts[] = { 1, 10, 100 };
+
+/* Changes per second, 0 sends them all at once */
+static const guint rates[] = { 10, 100, 1000, 0 };
+
+#define MAX_EVENTS              2000
+
+typedef struct
+{
+	const gchar    *name;
+	BatteryBackend *(*new) (void);
+} BenchBackend;
+
+static const BenchBackend backends[] = {
+	{ "upower", battery_upower_new },
+	{ "dbus",   battery_dbus_new },
+};
+
+
+/*
+ * The fake UPower
+ */
+
+static const gchar fake_introspection[] =
+	"<node>"
+	"  <interface name='" UPOWER_IFACE "'>"
+	"    <method name='EnumerateDevices'>"
+	"      <arg name='devices' direction='out' type='ao'/>"
+	"    </method>"
+	"    <method name='GetDisplayDevice'>"
+	"      <arg name='device' direction='out' type='o'/>"
+	"    </method>"
+	"    <method name='GetCriticalAction'>"
+	"      <arg name='action' direction='out' type='s'/>"
+	"    </method>"
+	"    <signal name='DeviceAdded'><arg name='device' type='o'/></signal>"
+	"    <signal name='DeviceRemoved'><arg name='device' type='o'/></signal>"
+	"    <property name='DaemonVersion' type='s' access='read'/>"
+	"    <property name='OnBattery' type='b' access='read'/>"
+	"    <property name='LidIsClosed' type='b' access='read'/>"
+	"    <property name='LidIsPresent' type='b' access='read'/>"
+	"  </interface>"
+	"  <interface name='" UPOWER_IFACE_DEVICE "'>"
+	"    <method name='Refresh'/>"
+	"    <property name='NativePath' type='s' access='read'/>"
+	"    <property name='Vendor' type='s' access='read'/>"
+	"    <property name='Model' type='s' access='read'/>"
+	"    <property name='Serial' type='s' access='read'/>"
+	"    <property name='UpdateTime' type='t' access='read'/>"
+	"    <property name='Type' type='u' access='read'/>"
+	"    <property name='PowerSupply' type='b' access='read'/>"
+	"    <property name='HasHistory' type='b' access='read'/>"
+	"    <property name='HasStatistics' type='b' access='read'/>"
+	"    <property name='Online' type='b' access='read'/>"
+	"    <property name='Energy' type='d' access='read'/>"
+	"    <property name='EnergyEmpty' type='d' access='read'/>"
+	"    <property name='EnergyFull' type='d' access='read'/>"
+	"    <property name='EnergyFullDesign' type='d' access='read'/>"
+	"    <property name='EnergyRate' type='d' access='read'/>"
+	"    <property name='Voltage' type='d' access='read'/>"
+	"    <property name='Luminosity' type='d' access='read'/>"
+	"    <property name='TimeToEmpty' type='x' access='read'/>"
+	"    <property name='TimeToFull' type='x' access='read'/>"
+	"    <property name='Percentage' type='d' access='read'/>"
+	"    <property name='Temperature' type='d' access='read'/>"
+	"    <property name='IsPresent' type='b' access='read'/>"
+	"    <property name='IsRechargeable' type='b' access='read'/>"
+	"    <property name='State' type='u' access='read'/>"
+	"    <property name='Technology' type='u' access='read'/>"
+	"    <property name='Capacity' type='d' access='read'/>"
+	"    <property name='IconName' type='s' access='read'/>"
+	"    <property name='WarningLevel' type='u' access='read'/>"
+	"    <property name='BatteryLevel' type='u' access='read'/>"
+	"  </interface>"
+	"</node>";
+
+typedef struct
+{
+	gchar   *object_path;
+	gchar   *native_path;
+	gboolean is_display;
+	gdouble  percentage;
+	gint64   time_to_empty;
+	guint64  update_time;
+} FakeDevice;
+
+typedef struct
+{
+	GDBusConnection *connection;
+	GDBusNodeInfo   *info;
+	GMainLoop       *loop;
+
+	FakeDevice       display;
+	FakeDevice      *batteries;
+	guint            n_batteries;
+
+	guint            rate;
+	guint            n_events;
+	guint            n_emitted;
+	gint64           start_time;
+	gint64          *emit_times;
+	guint            storm_id;
+} FakeUpower;
+
+static GVariant *
+fake_device_get_property (FakeDevice *device, const gchar *name)
+{
+	if (g_strcmp0 (name, "NativePath") == 0)
+		return g_variant_new_string (device->native_path);
+	if (g_strcmp0 (name, "Vendor") == 0)
+		return g_variant_new_string (device->is_display ? "" : "Bench");
+	if (g_strcmp0 (name, "Model") == 0)
+		return g_variant_new_string (device->is_display ? "" : "Fake battery");
+	if (g_strcmp0 (name, "Serial") == 0)
+		return g_variant_new_string ("");
+	if (g_strcmp0 (name, "UpdateTime") == 0)
+		return g_variant_new_uint64 (device->update_time);
+	if (g_strcmp0 (name, "Type") == 0)
+		return g_variant_new_uint32 (UP_DEVICE_KIND_BATTERY);
+	if (g_strcmp0 (name, "PowerSupply") == 0)
+		return g_variant_new_boolean (TRUE);
+	if (g_strcmp0 (name, "IsPresent") == 0)
+		return g_variant_new_boolean (TRUE);
+	if (g_strcmp0 (name, "IsRechargeable") == 0)
+		return g_variant_new_boolean (!device->is_display);
+	if (g_strcmp0 (name, "HasHistory") == 0 ||
+	    g_strcmp0 (name, "HasStatistics") == 0 ||
+	    g_strcmp0 (name, "Online") == 0)
+		return g_variant_new_boolean (FALSE);
+	if (g_strcmp0 (name, "TimeToEmpty") == 0)
+		return g_variant_new_int64 (device->time_to_empty);
+	if (g_strcmp0 (name, "TimeToFull") == 0)
+		return g_variant_new_int64 (0);
+	if (g_strcmp0 (name, "Percentage") == 0)
+		return g_variant_new_double (device->percentage);
+	if (g_strcmp0 (name, "Energy") == 0)
+		return g_variant_new_double (device->percentage / 2);
+	if (g_strcmp0 (name, "EnergyFull") == 0 ||
+	    g_strcmp0 (name, "EnergyFullDesign") == 0)
+		return g_variant_new_double (50);
+	if (g_strcmp0 (name, "Capacity") == 0)
+		return g_variant_new_double (100);
+	if (g_strcmp0 (name, "State") == 0)
+		return g_variant_new_uint32 (UP_DEVICE_STATE_DISCHARGING);
+	if (g_strcmp0 (name, "Technology") == 0)
+		return g_variant_new_uint32 (UP_DEVICE_TECHNOLOGY_LITHIUM_ION);
+	if (g_strcmp0 (name, "IconName") == 0)
+		return g_variant_new_string ("battery-good-symbolic");
+	if (g_strcmp0 (name, "WarningLevel") == 0)
+		return g_variant_new_uint32 (UP_DEVICE_LEVEL_NONE);
+	if (g_strcmp0 (name, "BatteryLevel") == 0)
+		return g_variant_new_uint32 (UP_DEVICE_LEVEL_NONE);
+
+	/* the remaining doubles */
+	return g_variant_new_double (0);
+}
+
+static GVariant *
+fake_device_get_property_cb (GDBusConnection *connection,
+                             const gchar     *sender,
+                             const gchar     *object_path,
+                             const gchar     *interface_name,
+                             const gchar     *property_name,
+                             GError         **error,
+                             gpointer         data)
+{
+	return fake_device_get_property (data, property_name);
+}
+
+static void
+fake_device_method_call_cb (GDBusConnection       *connection,
+                            const gchar           *sender,
+                            const gchar           *object_path,
+                            const gchar           *interface_name,
+                            const gchar           *method_name,
+                            GVariant              *parameters,
+                            GDBusMethodInvocation *invocation,
+                            gpointer               data)
+{
+	/* Refresh, there is nothing to refresh */
+	g_dbus_method_invocation_return_value (invocation, NULL);
+}
+
+static GVariant *
+fake_daemon_get_property_cb (GDBusConnection *connection,
+                             const gchar     *sender,
+                             const gchar     *object_path,
+                             const gchar     *interface_name,
+                             const gchar     *property_name,
+                             GError         **error,
+                             gpointer         data)
+{
+	if (g_strcmp0 (property_name, "DaemonVersion") == 0)
+		return g_variant_new_string ("0.99.99");
+
+	return g_variant_new_boolean (g_strcmp0 (property_name, "OnBattery") == 0);
+}
+
+static void
+fake_daemon_method_call_cb (GDBusConnection       *connection,
+                            const gchar           *sender,
+                            const gchar           *object_path,
+                            const gchar           *interface_name,
+                            const gchar           *method_name,
+                            GVariant              *parameters,
+                            GDBusMethodInvocation *invocation,
+                            gpointer               data)
+{
+	FakeUpower *fake = data;
+
+	if (g_strcmp0 (method_name, "EnumerateDevices") == 0)
+	{
+		GVariantBuilder builder;
+		guint i;
+
+		/* like upowerd, without the display device */
+		g_variant_builder_init (&builder, G_VARIANT_TYPE ("ao"));
+		for (i = 0; i < fake->n_batteries; i++)
+			g_variant_builder_add (&builder, "o", fake->batteries[i].object_path);
+
+		g_dbus_method_invocation_return_value (invocation, g_variant_new ("(ao)", &builder));
+	}
+	else if (g_strcmp0 (method_name, "GetDisplayDevice") == 0)
+	{
+		g_dbus_method_invocation_return_value (invocation,
+		                                       g_variant_new ("(o)", fake->display.object_path));
+	}
+	else
+	{
+		g_dbus_method_invocation_return_value (invocation, g_variant_new ("(s)", "PowerOff"));
+	}
+}
+
+static const GDBusInterfaceVTable fake_daemon_vtable = {
+	fake_daemon_method_call_cb,
+	fake_daemon_get_property_cb,
+	NULL,
+};
+
+static const GDBusInterfaceVTable fake_device_vtable = {
+	fake_device_method_call_cb,
+	fake_device_get_property_cb,
+	NULL,
+};
+
+static void
+fake_device_register (FakeUpower *fake, FakeDevice *device)
+{
+	GError *error = NULL;
+
+	if (!g_dbus_connection_register_object (fake->connection, device->object_path,
+	                                        g_dbus_node_info_lookup_interface (fake->info, UPOWER_IFACE_DEVICE),
+	                                        &fake_device_vtable, device, NULL, &error))
+		g_error ("Unable to export %s: %s", device->object_path, error->message);
+}
+
+/* What upowerd sends when a battery is polled */
+static void
+fake_device_emit_changed (FakeUpower *fake, FakeDevice *device)
+{
+	GVariantBuilder builder;
+
+	g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{sv}"));
+	g_variant_builder_add (&builder, "{sv}", "Percentage", g_variant_new_double (device->percentage));
+	g_variant_builder_add (&builder, "{sv}", "Energy", g_variant_new_double (device->percentage / 2));
+	g_variant_builder_add (&builder, "{sv}", "TimeToEmpty", g_variant_new_int64 (device->time_to_empty));
+	g_variant_builder_add (&builder, "{sv}", "UpdateTime", g_variant_new_uint64 (device->update_time));
+
+	g_dbus_connection_emit_signal (fake->connection, NULL, device->object_path,
+	                               "org.freedesktop.DBus.Properties", "PropertiesChanged",
+	                               g_variant_new ("(sa{sv}@as)", UPOWER_IFACE_DEVICE, &builder,
+	                                              g_variant_new_strv (NULL, 0)),
+	                               NULL);
+}
+
+/* Change number @event goes to battery event % n_batteries, which goes
+ * down by one percent from 99, and to the display device, which does the
+ * same for every change.  Both start at 100 so the harness can tell the
+ * changes apart by percentage alone. */
+static void
+fake_emit_event (FakeUpower *fake, guint event)
+{
+	FakeDevice *battery = &fake->batteries[event % fake->n_batteries];
+	guint seq = event / fake->n_batteries;
+
+	fake->emit_times[event] = g_get_monotonic_time ();
+
+	battery->percentage = 99 - seq % 100;
+	battery->time_to_empty = (gint64) battery->percentage * 72;
+	battery->update_time = g_get_real_time () / G_USEC_PER_SEC;
+	fake_device_emit_changed (fake, battery);
+
+	fake->display.percentage = 99 - event % 100;
+	fake->display.time_to_empty = (gint64) fake->display.percentage * 72;
+	fake->display.update_time = battery->update_time;
+	fake_device_emit_changed (fake, &fake->display);
+}
+
+static gboolean
+fake_storm_cb (gpointer data)
+{
+	FakeUpower *fake = data;
+	guint target, i;
+
+	if (fake->rate == 0)
+	{
+		/* in chunks so incoming calls still get answered */
+		target = MIN (fake->n_emitted + 50, fake->n_events);
+	}
+	else
+	{
+		gint64 elapsed = g_get_monotonic_time () - fake->start_time;
+
+		target = MIN (elapsed * fake->rate / G_USEC_PER_SEC + 1, fake->n_events);
+	}
+
+	for (; fake->n_emitted < target; fake->n_emitted++)
+		fake_emit_event (fake, fake->n_emitted);
+
+	if (fake->n_emitted < fake->n_events)
+		return TRUE;
+
+	g_dbus_connection_flush_sync (fake->connection, NULL, NULL);
+
+	/* hand the send times to the harness */
+	for (i = 0; i < fake->n_events; i++)
+		printf ("%u %" G_GINT64_FORMAT "\n", i, fake->emit_times[i]);
+	printf ("end\n");
+	fflush (stdout);
+
+	fake->storm_id = 0;
+
+	return FALSE;
+}
+
+static gboolean
+fake_stdin_cb (gint fd, GIOCondition condition, gpointer data)
+{
+	FakeUpower *fake = data;
+	gchar buf[64];
+	gssize len;
+
+	len = read (fd, buf, sizeof (buf));
+
+	/* the harness is done with us */
+	if (len <= 0)
+	{
+		g_main_loop_quit (fake->loop);
+		return FALSE;
+	}
+
+	if (fake->storm_id == 0 && fake->n_emitted == 0)
+	{
+		fake->start_time = g_get_monotonic_time ();
+
+		if (fake->rate == 0)
+			fake->storm_id = g_idle_add (fake_storm_cb, fake);
+		else
+			fake->storm_id = g_timeout_add (10, fake_storm_cb, fake);
+	}
+
+	return TRUE;
+}
+
+static void
+fake_name_acquired_cb (GDBusConnection *connection, const gchar *name, gpointer data)
+{
+	printf ("ready\n");
+	fflush (stdout);
+}
+
+static void
+fake_name_lost_cb (GDBusConnection *connection, const gchar *name, gpointer data)
+{
+	g_error ("Unable to own %s", name);
+}
+
+static int
+fake_upower_main (guint n_batteries, guint rate, guint n_events)
+{
+	FakeUpower fake = { 0, };
+	GError *error = NULL;
+	guint i;
+
+	fake.connection = g_bus_get_sync (G_BUS_TYPE_SYSTEM, NULL, &error);
+	if (fake.connection == NULL)
+		g_error ("Unable to connect to the bus: %s", error->message);
+
+	fake.info = g_dbus_node_info_new_for_xml (fake_introspection, NULL);
+	fake.loop = g_main_loop_new (NULL, FALSE);
+	fake.rate = rate;
+	fake.n_events = n_events;
+	fake.emit_times = g_new0 (gint64, n_events);
+
+	if (!g_dbus_connection_register_object (fake.connection, UPOWER_PATH,
+	                                        g_dbus_node_info_lookup_interface (fake.info, UPOWER_IFACE),
+	                                        &fake_daemon_vtable, &fake, NULL, &error))
+		g_error ("Unable to export %s: %s", UPOWER_PATH, error->message);
+
+	fake.display.object_path = g_strdup (FAKE_DISPLAY_PATH);
+	fake.display.native_path = g_strdup ("");
+	fake.display.is_display = TRUE;
+	fake.display.percentage = 100;
+	fake_device_register (&fake, &fake.display);
+
+	fake.n_batteries = n_batteries;
+	fake.batteries = g_new0 (FakeDevice, n_batteries);
+	for (i = 0; i < n_batteries; i++)
+	{
+		fake.batteries[i].object_path = g_strdup_printf (FAKE_BATTERY_PATH, i);
+		fake.batteries[i].native_path = g_strdup_printf ("BAT%u", i);
+		fake.batteries[i].percentage = 100;
+		fake_device_register (&fake, &fake.batteries[i]);
+	}
+
+	g_bus_own_name_on_connection (fake.connection, UPOWER_NAME, G_BUS_NAME_OWNER_FLAGS_NONE,
+	                              fake_name_acquired_cb, fake_name_lost_cb, &fake, NULL);
+
+	g_unix_fd_add (STDIN_FILENO, G_IO_IN | G_IO_HUP, fake_stdin_cb, &fake);
+
+	g_main_loop_run (fake.loop);
+
+	return EXIT_SUCCESS;
+}
+
+
+/*
+ * The harness
+ */
+
+typedef struct
+{
+	guint  event;
+	gint64 time;
+} BenchUpdate;
+
+typedef struct
+{
+	const BenchBackend *backend_type;
+	guint           n_devices;
+	guint           rate;
+	guint           n_events;
+
+	GMainLoop      *loop;
+	gboolean        failed;
+	gboolean        enumerated;
+
+	GPid            pid;
+	gint            stdin_fd;
+	GIOChannel     *output;
+	guint           output_id;
+	guint           settle_id;
+
+	BatteryBackend *backend;
+	BatteryModel   *model;
+	GQuark          display_path;
+
+	gint64         *emit_times;
+	gint           *last_seq;
+	gint            last_display_seq;
+	GArray         *tray_updates;
+	GArray         *device_updates;
+
+	gint64          cpu_start;
+	gint64          cpu_end;
+} BenchRun;
+
+static GString  *json;
+static gboolean  first_result = TRUE;
+
+static gint64
+get_cpu_time (void)
+{
+	struct rusage usage;
+
+	getrusage (RUSAGE_SELF, &usage);
+
+	return (gint64) (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * G_USEC_PER_SEC
+	       + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+/* The first sequence number after @last whose percentage is @percentage,
+ * or -1 for the initial 100 % */
+static gint
+next_seq (gint last, gint percentage)
+{
+	gint seq;
+
+	if (percentage < 0 || percentage > 99)
+		return -1;
+
+	seq = last + 1;
+	seq += (99 - percentage - seq % 100 + 100) % 100;
+
+	return seq;
+}
+
+static void
+record_update (GArray *updates, guint event)
+{
+	BenchUpdate update;
+
+	update.event = event;
+	update.time = g_get_monotonic_time ();
+
+	g_array_append_val (updates, update);
+}
+
+static void start_run (BenchRun *run);
+
+static void
+model_device_added_cb (BatteryModelDevice *device, gpointer data)
+{
+	guint index;
+
+	/* remember which battery it is, the display device stays at 0 */
+	if (sscanf (g_quark_to_string (device->object_path), FAKE_BATTERY_PATH, &index) == 1)
+		device->view_data = GUINT_TO_POINTER (index + 1);
+
+	start_run (data);
+}
+
+static void
+model_device_changed_cb (BatteryModelDevice *device, gpointer data)
+{
+	BenchRun *run = data;
+	guint index;
+	gint seq;
+
+	if (device->view_data == NULL)
+		return;
+
+	index = GPOINTER_TO_UINT (device->view_data) - 1;
+
+	seq = next_seq (run->last_seq[index], device->snapshot.percentage);
+	if (seq < 0)
+		return;
+
+	run->last_seq[index] = seq;
+	record_update (run->device_updates, seq * run->n_devices + index);
+}
+
+static void
+model_device_removed_cb (BatteryModelDevice *device, gpointer data)
+{
+}
+
+static void
+model_display_changed_cb (BatteryModelDevice *device, gpointer data)
+{
+	BenchRun *run = data;
+	gchar *icon_name, *description;
+	gint seq;
+
+	if (device == NULL || device->object_path != run->display_path)
+		return;
+
+	/* what the plugin does for the tray image and tooltip */
+	icon_name = xfpm_device_snapshot_get_icon_name (&device->snapshot);
+	description = xfpm_device_snapshot_get_description (&device->snapshot);
+	g_free (icon_name);
+	g_free (description);
+
+	seq = next_seq (run->last_display_seq, device->snapshot.percentage);
+	if (seq < 0)
+		return;
+
+	run->last_display_seq = seq;
+	record_update (run->tray_updates, seq);
+}
+
+static const BatteryModelListener model_listener = {
+	model_device_added_cb,
+	model_device_changed_cb,
+	model_device_removed_cb,
+	model_display_changed_cb,
+};
+
+static void
+run_fail (BenchRun *run, const gchar *message)
+{
+	fprintf (stderr, "%s, %u devices at %u/s: %s\n",
+	         run->backend_type->name, run->n_devices, run->rate, message);
+
+	run->failed = TRUE;
+	g_main_loop_quit (run->loop);
+}
+
+/* Once every battery and the display device are in the model */
+static void
+start_run (BenchRun *run)
+{
+	if (!run->enumerated || run->cpu_start != 0 ||
+	    battery_model_get_n_devices (run->model) != run->n_devices + 1)
+		return;
+
+	/* let the initial snapshots through before measuring */
+	battery_model_flush (run->model);
+
+	run->cpu_start = get_cpu_time ();
+
+	if (write (run->stdin_fd, "go\n", 3) != 3)
+		run_fail (run, "unable to start the fake UPower");
+}
+
+static void
+backend_ready_cb (gboolean success, gpointer data)
+{
+	BenchRun *run = data;
+
+	/* the UPower backend adds the display device after this */
+	if (!success || battery_model_get_n_devices (run->model) < run->n_devices)
+	{
+		run_fail (run, "the fake UPower was not enumerated");
+		return;
+	}
+
+	run->enumerated = TRUE;
+	start_run (run);
+}
+
+static gboolean
+settle_cb (gpointer data)
+{
+	BenchRun *run = data;
+
+	run->settle_id = 0;
+	run->cpu_end = get_cpu_time ();
+
+	g_main_loop_quit (run->loop);
+
+	return FALSE;
+}
+
+static gboolean
+fake_output_cb (GIOChannel *channel, GIOCondition condition, gpointer data)
+{
+	BenchRun *run = data;
+	gchar *line = NULL;
+	guint event;
+	gint64 time;
+
+	while (g_io_channel_read_line (channel, &line, NULL, NULL, NULL) == G_IO_STATUS_NORMAL)
+	{
+		if (g_str_has_prefix (line, "ready"))
+		{
+			run->backend = run->backend_type->new ();
+			battery_model_set_backend (run->model, run->backend);
+			battery_backend_enumerate (run->backend, backend_ready_cb, run);
+		}
+		else if (g_str_has_prefix (line, "end"))
+		{
+			run->settle_id = g_timeout_add (SETTLE_TIME, settle_cb, run);
+		}
+		else if (sscanf (line, "%u %" G_GINT64_FORMAT, &event, &time) == 2
+		         && event < run->n_events)
+		{
+			run->emit_times[event] = time;
+		}
+
+		g_free (line);
+	}
+
+	if (condition & G_IO_HUP)
+	{
+		if (run->settle_id == 0 && run->cpu_end == 0)
+			run_fail (run, "the fake UPower went away");
+
+		run->output_id = 0;
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static gint
+compare_latency (gconstpointer a, gconstpointer b)
+{
+	gint64 la = *(const gint64 *) a, lb = *(const gint64 *) b;
+
+	return (la > lb) - (la < lb);
+}
+
+static void
+report (BenchRun *run, const gchar *name, GArray *updates)
+{
+	gint64 *latencies;
+	guint i, n = 0;
+
+	latencies = g_new (gint64, updates->len + 1);
+
+	for (i = 0; i < updates->len; i++)
+	{
+		BenchUpdate *update = &g_array_index (updates, BenchUpdate, i);
+
+		if (update->event < run->n_events && run->emit_times[update->event] > 0)
+			latencies[n++] = update->time - run->emit_times[update->event];
+	}
+
+	qsort (latencies, n, sizeof (gint64), compare_latency);
+
+	g_string_append_printf (json,
+	                        "%s\n    { \"name\": \"%s\", \"backend\": \"%s\", \"devices\": %u, "
+	                        "\"rate\": %u, \"events\": %u, \"updates\": %u, ",
+	                        first_result ? "" : ",",
+	                        name, run->backend_type->name, run->n_devices, run->rate, run->n_events, n);
+
+	if (n > 0)
+		g_string_append_printf (json,
+		                        "\"p50_us\": %" G_GINT64_FORMAT ", \"p99_us\": %" G_GINT64_FORMAT ", "
+		                        "\"max_us\": %" G_GINT64_FORMAT ", ",
+		                        latencies[n / 2], latencies[MIN (n * 99 / 100, n - 1)],
+		                        latencies[n - 1]);
+	else
+		g_string_append (json, "\"p50_us\": null, \"p99_us\": null, \"max_us\": null, ");
+
+	g_string_append_printf (json, "\"cpu_us_per_event\": %.1f }",
+	                        (gdouble) (run->cpu_end - run->cpu_start) / run->n_events);
+
+	first_result = FALSE;
+
+	fprintf (stderr, "%-14s %-7s %4u devices %5u/s %5u events %5u updates  p50 %6" G_GINT64_FORMAT
+	         " us  p99 %6" G_GINT64_FORMAT " us\n",
+	         name, run->backend_type->name, run->n_devices, run->rate, run->n_events, n,
+	         n > 0 ? latencies[n / 2] : 0,
+	         n > 0 ? latencies[MIN (n * 99 / 100, n - 1)] : 0);
+
+	g_free (latencies);
+}
+
+static gboolean
+bench_run (const gchar *self, const BenchBackend *backend_type, guint n_devices, guint rate)
+{
+	BenchRun run = { 0, };
+	gchar *argv[6];
+	gint stdout_fd;
+	GError *error = NULL;
+	guint i;
+
+	run.backend_type = backend_type;
+	run.n_devices = n_devices;
+	run.rate = rate;
+	run.n_events = rate ? CLAMP (rate * 5, 100, MAX_EVENTS) : MAX_EVENTS;
+	run.loop = g_main_loop_new (NULL, FALSE);
+	run.display_path = g_quark_from_string (FAKE_DISPLAY_PATH);
+	run.emit_times = g_new0 (gint64, run.n_events);
+	run.last_seq = g_new (gint, n_devices);
+	run.last_display_seq = -1;
+	run.tray_updates = g_array_new (FALSE, FALSE, sizeof (BenchUpdate));
+	run.device_updates = g_array_new (FALSE, FALSE, sizeof (BenchUpdate));
+
+	for (i = 0; i < n_devices; i++)
+		run.last_seq[i] = -1;
+
+	argv[0] = (gchar *) self;
+	argv[1] = (gchar *) "--fake-upower";
+	argv[2] = g_strdup_printf ("%u", n_devices);
+	argv[3] = g_strdup_printf ("%u", rate);
+	argv[4] = g_strdup_printf ("%u", run.n_events);
+	argv[5] = NULL;
+
+	if (!g_spawn_async_with_pipes (NULL, argv, NULL, G_SPAWN_DO_NOT_REAP_CHILD, NULL, NULL,
+	                               &run.pid, &run.stdin_fd, &stdout_fd, NULL, &error))
+	{
+		fprintf (stderr, "Unable to start the fake UPower: %s\n", error->message);
+		g_error_free (error);
+		run.failed = TRUE;
+		goto out;
+	}
+
+	run.output = g_io_channel_unix_new (stdout_fd);
+	g_io_channel_set_close_on_unref (run.output, TRUE);
+	g_io_channel_set_flags (run.output, G_IO_FLAG_NONBLOCK, NULL);
+	run.output_id = g_io_add_watch (run.output, G_IO_IN | G_IO_HUP, fake_output_cb, &run);
+
+	run.model = battery_model_new (&model_listener, &run);
+
+	g_main_loop_run (run.loop);
+
+	if (!run.failed)
+	{
+		report (&run, "tray_update", run.tray_updates);
+		report (&run, "device_update", run.device_updates);
+	}
+
+	/* the fake exits when its stdin is closed */
+	if (run.output_id)
+		g_source_remove (run.output_id);
+	if (run.settle_id)
+		g_source_remove (run.settle_id);
+
+	close (run.stdin_fd);
+	waitpid (run.pid, NULL, 0);
+	g_spawn_close_pid (run.pid);
+	g_io_channel_unref (run.output);
+
+	battery_model_free (run.model);
+	if (run.backend)
+		battery_backend_free (run.backend);
+
+out:
+	g_free (argv[2]);
+	g_free (argv[3]);
+	g_free (argv[4]);
+	g_free (run.emit_times);
+	g_free (run.last_seq);
+	g_array_free (run.tray_updates, TRUE);
+	g_array_free (run.device_updates, TRUE);
+	g_main_loop_unref (run.loop);
+
+	return !run.failed;
+}
+
+int
+main (int argc, char **argv)
+{
+	GTestDBus *bus;
+	gboolean success = TRUE;
+	gchar *daemon;
+	guint n, r, b;
+
+	if (argc == 5 && g_strcmp0 (argv[1], "--fake-upower") == 0)
+		return fake_upower_main (atoi (argv[2]), atoi (argv[3]), atoi (argv[4]));
+
+	daemon = g_find_program_in_path ("dbus-daemon");
+	if (daemon == NULL)
+	{
+		fprintf (stderr, "dbus-daemon is needed for a private bus, skipping\n");
+		return 77;
+	}
+	g_free (daemon);
+
+	/* a private bus stands in for the system bus, for us and the fake */
+	bus = g_test_dbus_new (G_TEST_DBUS_NONE);
+	g_test_dbus_up (bus);
+	g_setenv ("DBUS_SYSTEM_BUS_ADDRESS", g_test_dbus_get_bus_address (bus), TRUE);
+
+	json = g_string_new ("{\n  \"benchmarks\": [");
+
+	for (n = 0; n < G_N_ELEMENTS (device_counts); n++)
+		for (r = 0; r < G_N_ELEMENTS (rates); r++)
+			for (b = 0; b < G_N_ELEMENTS (backends); b++)
+				success &= bench_run (argv[0], &backends[b], device_counts[n], rates[r]);
+
+	g_string_append (json, "\n  ]\n}\n");
+
+	if (argc > 1)
+	{
+		GError *error = NULL;
+
+		if (!g_file_set_contents (argv[1], json->str, json->len, &error))
+		{
+			fprintf (stderr, "Unable to write %s: %s\n", argv[1], error->message);
+			g_error_free (error);
+			success = FALSE;
+		}
+	}
+	else
+	{
+		fputs (json->str, stdout);
+	}
+
+	g_string_free (json, TRUE);
+
+	g_test_dbus_down (bus);
+	g_object_unref (bus);
+
+	return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,91 @@
+/*
+ *  Copyright (C) 2015-2019 Gooroom <gooroom@gooroom.kr>
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <glib.h>
+
+#include "battery-backend.h"
+
+
+const gchar *
+battery_backend_get_name (BatteryBackend *backend)
+{
+	return backend->klass->name;
+}
+
+/**
+ * battery_backend_subscribe:
+ *
+ * Set the function told about added, changed and removed devices.  It
+ * may be called before battery_backend_enumerate () returns.
+ **/
+void
+battery_backend_subscribe (BatteryBackend     *backend,
+                           BatteryBackendFunc  func,
+                           gpointer            user_data)
+{
+	backend->func = func;
+	backend->user_data = user_data;
+}
+
+void
+battery_backend_enumerate (BatteryBackend          *backend,
+                           BatteryBackendReadyFunc  callback,
+                           gpointer                 user_data)
+{
+	backend->klass->enumerate (backend, callback, user_data);
+}
+
+gboolean
+battery_backend_get_snapshot (BatteryBackend     *backend,
+                              const gchar        *object_path,
+                              XfpmDeviceSnapshot *snapshot)
+{
+	return backend->klass->get_snapshot (backend, object_path, snapshot);
+}
+
+const gchar *
+battery_backend_get_display_device (BatteryBackend *backend)
+{
+	if (backend == NULL || backend->klass->get_display_device == NULL)
+		return NULL;
+
+	return backend->klass->get_display_device (backend);
+}
+
+void
+battery_backend_free (BatteryBackend *backend)
+{
+	if (backend == NULL)
+		return;
+
+	backend->klass->free (backend);
+}
+
+void
+battery_backend_emit (BatteryBackend      *backend,
+                      BatteryBackendEvent  event,
+                      const gchar         *object_path)
+{
+	if (backend->func)
+		backend->func (event, object_path, backend->user_data);
+}
@@ -0,0 +1,110 @@
+/*
+ *  Copyright (C) 2015-2019 Gooroom <gooroom@gooroom.kr>
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef __BATTERY_BACKEND_H__
+#define __BATTERY_BACKEND_H__
+
+#include <glib.h>
+
+#include "xfpm-power-common.h"
+
+G_BEGIN_DECLS
+
+/* Where the devices come from: UPower, sysfs or a scripted mock.  The
+ * plugin only sees object paths and pulls a snapshot when it refreshes
+ * a device, so any number of change events between two refreshes cost
+ * one read, plus one per CHANGED event to look for a critical change. */
+typedef struct _BatteryBackend      BatteryBackend;
+typedef struct _BatteryBackendClass BatteryBackendClass;
+
+/* CHANGED is for the fields a critical change shows up in: state,
+ * online and percentage.  Everything else (kind, icon, energy rate, time
+ * estimates, ...) is CHANGED_DETAILS and waits for the next refresh.
+ * Backends that can't tell send CHANGED. */
+typedef enum
+{
+	BATTERY_BACKEND_ADDED,
+	BATTERY_BACKEND_CHANGED,
+	BATTERY_BACKEND_CHANGED_DETAILS,
+	BATTERY_BACKEND_REMOVED
+} BatteryBackendEvent;
+
+typedef void (*BatteryBackendFunc)      (BatteryBackendEvent  event,
+                                         const gchar         *object_path,
+                                         gpointer             user_data);
+
+/* Called once the initial devices were reported as added */
+typedef void (*BatteryBackendReadyFunc) (gboolean             success,
+                                         gpointer             user_data);
+
+struct _BatteryBackendClass
+{
+	const gchar *name;
+
+	/* Report every device as added, then call @callback, possibly
+	 * before returning */
+	void         (*enumerate)          (BatteryBackend          *backend,
+	                                    BatteryBackendReadyFunc  callback,
+	                                    gpointer                 user_data);
+
+	/* Fill @snapshot for the device, FALSE if it is not known */
+	gboolean     (*get_snapshot)       (BatteryBackend          *backend,
+	                                    const gchar             *object_path,
+	                                    XfpmDeviceSnapshot      *snapshot);
+
+	/* The composite device shown in the tray, NULL if there is none */
+	const gchar *(*get_display_device) (BatteryBackend          *backend);
+
+	void         (*free)               (BatteryBackend          *backend);
+};
+
+/* Implementations start with this */
+struct _BatteryBackend
+{
+	const BatteryBackendClass *klass;
+
+	BatteryBackendFunc  func;
+	gpointer            user_data;
+};
+
+const gchar *battery_backend_get_name           (BatteryBackend          *backend);
+
+void         battery_backend_subscribe          (BatteryBackend          *backend,
+                                                 BatteryBackendFunc       func,
+                                                 gpointer                 user_data);
+
+void         battery_backend_enumerate          (BatteryBackend          *backend,
+                                                 BatteryBackendReadyFunc  callback,
+                                                 gpointer                 user_data);
+
+gboolean     battery_backend_get_snapshot       (BatteryBackend          *backend,
+                                                 const gchar             *object_path,
+                                                 XfpmDeviceSnapshot      *snapshot);
+
+const gchar *battery_backend_get_display_device (BatteryBackend          *backend);
+
+void         battery_backend_free               (BatteryBackend          *backend);
+
+/* For implementations */
+void         battery_backend_emit               (BatteryBackend          *backend,
+                                                 BatteryBackendEvent      event,
+                                                 const gchar             *object_path);
+
+G_END_DECLS
+
+#endif /* !__BATTERY_BACKEND_H__ */
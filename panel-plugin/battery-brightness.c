@@ -0,0 +1,712 @@
+/*
+ *  Copyright (C) 2015-2019 Gooroom <gooroom@gooroom.kr>
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <glib-unix.h>
+#include <gio/gio.h>
+
+#include <libxfce4util/libxfce4util.h>
+
+#include "battery-brightness.h"
+
+
+#define BACKLIGHT_SYSFS_DIR     "/sys/class/backlight"
+
+#define LOGIND_NAME             "org.freedesktop.login1"
+#define LOGIND_SESSION_PATH     "/org/freedesktop/login1/session/auto"
+#define LOGIND_SESSION_IFACE    "org.freedesktop.login1.Session"
+
+#define HELPER_PATH             SBINDIR "/xfpm-power-backlight-helper"
+
+
+struct _BatteryBrightness
+{
+	const BatteryBrightnessBackend *backend;
+
+	gchar           *backlight_name;    /* e.g. intel_backlight */
+	gchar           *backlight_dir;     /* /sys/class/backlight/<name> */
+	gint32           max_level;         /* Read once, -1 if unknown */
+
+	/* actual_brightness is kept open and polled for sysfs_notify ()
+	 * while someone listens for level changes */
+	gint             level_fd;
+	guint            level_watch_id;
+	BatteryBrightnessLevelFunc level_func;
+	gpointer         level_func_data;
+
+	GDBusConnection *system_bus;        /* Only used by the logind backend */
+	struct _BrightnessOp *bus_wait_op;  /* A write waiting for the bus */
+	gchar           *pkexec;            /* Only used by the helper backend */
+
+	/* Cancelled on free so pending writes don't call back */
+	GCancellable    *cancellable;
+
+	/* Requested levels: at most one write is in flight and only the
+	 * newest request waits behind it */
+	gboolean         in_flight;
+	gint64           in_flight_time;    /* When its level was requested */
+	gint32           pending_level;     /* -1 if none */
+	gint64           pending_time;
+
+	BatteryBrightnessStats stats;
+};
+
+/* One pending write */
+typedef struct _BrightnessOp
+{
+	BatteryBrightness     *brightness;  /* Only valid if not cancelled */
+	GCancellable          *cancellable;
+	gint32                 level;
+	gchar                 *path;
+	BatteryBrightnessFunc  callback;
+	gpointer               user_data;
+} BrightnessOp;
+
+
+static BrightnessOp *
+brightness_op_new (BatteryBrightness     *brightness,
+                   gint32                 level,
+                   BatteryBrightnessFunc  callback,
+                   gpointer               user_data)
+{
+	BrightnessOp *op = g_new0 (BrightnessOp, 1);
+
+	op->brightness = brightness;
+	op->cancellable = g_object_ref (brightness->cancellable);
+	op->level = level;
+	op->callback = callback;
+	op->user_data = user_data;
+
+	return op;
+}
+
+static void
+brightness_op_free (BrightnessOp *op)
+{
+	g_object_unref (op->cancellable);
+	g_free (op->path);
+	g_free (op);
+}
+
+static void
+brightness_op_finish (BrightnessOp *op, gboolean success)
+{
+	if (op->callback && !g_cancellable_is_cancelled (op->cancellable))
+		op->callback (success, op->user_data);
+
+	brightness_op_free (op);
+}
+
+
+
+/*
+ * Helper backend: pkexec xfpm-power-backlight-helper, spawned without
+ * waiting for it.
+ */
+static void
+helper_exited_cb (GPid pid, gint status, gpointer data)
+{
+	BrightnessOp *op = data;
+
+	g_spawn_close_pid (pid);
+
+	brightness_op_finish (op, g_spawn_check_exit_status (status, NULL));
+}
+
+static void
+helper_set_level (BatteryBrightness     *brightness,
+                  gint32                 level,
+                  BatteryBrightnessFunc  callback,
+                  gpointer               user_data)
+{
+	BrightnessOp *op;
+	GPid pid;
+	gchar *argv[5];
+	gchar level_str[16];
+	gint i = 0;
+
+	op = brightness_op_new (brightness, level, callback, user_data);
+
+	g_snprintf (level_str, sizeof (level_str), "%i", level);
+
+	if (brightness->pkexec)
+		argv[i++] = brightness->pkexec;
+	argv[i++] = HELPER_PATH;
+	argv[i++] = "--set-brightness";
+	argv[i++] = level_str;
+	argv[i] = NULL;
+
+	if (!g_spawn_async (NULL, argv, NULL,
+	                    G_SPAWN_DO_NOT_REAP_CHILD | G_SPAWN_STDOUT_TO_DEV_NULL | G_SPAWN_STDERR_TO_DEV_NULL,
+	                    NULL, NULL, &pid, NULL))
+	{
+		brightness_op_finish (op, FALSE);
+		return;
+	}
+
+	brightness->stats.n_spawns++;
+
+	g_child_watch_add (pid, helper_exited_cb, op);
+}
+
+static const BatteryBrightnessBackend helper_backend =
+{
+	"helper",
+	helper_set_level
+};
+
+
+
+/*
+ * logind backend: Session.SetBrightness, which lets the active session
+ * change its backlight without any privileged helper.
+ */
+static void
+logind_set_level_cb (GObject *source, GAsyncResult *res, gpointer data)
+{
+	BrightnessOp *op = data;
+	GVariant *ret;
+	GError *error = NULL;
+
+	ret = g_dbus_connection_call_finish (G_DBUS_CONNECTION (source), res, &error);
+	if (ret)
+	{
+		g_variant_unref (ret);
+		brightness_op_finish (op, TRUE);
+		return;
+	}
+
+	if (g_cancellable_is_cancelled (op->cancellable))
+	{
+		g_error_free (error);
+		brightness_op_free (op);
+		return;
+	}
+
+	/* logind too old or not allowed, use the helper from now on */
+	g_warning ("Unable to set brightness through logind: %s", error->message);
+	g_error_free (error);
+
+	op->brightness->backend = &helper_backend;
+	op->brightness->backend->set_level (op->brightness, op->level, op->callback, op->user_data);
+
+	brightness_op_free (op);
+}
+
+static void
+logind_call (BatteryBrightness *brightness, BrightnessOp *op)
+{
+	g_dbus_connection_call (brightness->system_bus,
+	                        LOGIND_NAME,
+	                        LOGIND_SESSION_PATH,
+	                        LOGIND_SESSION_IFACE,
+	                        "SetBrightness",
+	                        g_variant_new ("(ssu)", "backlight", brightness->backlight_name, (guint32) op->level),
+	                        NULL,
+	                        G_DBUS_CALL_FLAGS_NONE,
+	                        -1,
+	                        op->cancellable,
+	                        logind_set_level_cb,
+	                        op);
+}
+
+/* The connection is opened asynchronously when the backend is picked,
+ * a write requested before it is there waits for it */
+static void
+system_bus_ready_cb (GObject *source, GAsyncResult *res, gpointer data)
+{
+	BatteryBrightness *brightness;
+	GDBusConnection *connection;
+	BrightnessOp *op;
+	GError *error = NULL;
+
+	connection = g_bus_get_finish (res, &error);
+	if (connection == NULL && g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+	{
+		g_error_free (error);
+		return;
+	}
+
+	brightness = data;
+	op = brightness->bus_wait_op;
+	brightness->bus_wait_op = NULL;
+
+	if (connection == NULL)
+	{
+		g_warning ("Unable to connect to the system bus: %s", error->message);
+		g_error_free (error);
+
+		brightness->backend = &helper_backend;
+		if (op)
+		{
+			brightness->backend->set_level (brightness, op->level, op->callback, op->user_data);
+			brightness_op_free (op);
+		}
+		return;
+	}
+
+	brightness->system_bus = connection;
+
+	if (op)
+		logind_call (brightness, op);
+}
+
+static void
+logind_set_level (BatteryBrightness     *brightness,
+                  gint32                 level,
+                  BatteryBrightnessFunc  callback,
+                  gpointer               user_data)
+{
+	BrightnessOp *op;
+
+	op = brightness_op_new (brightness, level, callback, user_data);
+
+	/* writes never overlap, so at most one waits */
+	if (brightness->system_bus == NULL)
+		brightness->bus_wait_op = op;
+	else
+		logind_call (brightness, op);
+}
+
+static const BatteryBrightnessBackend logind_backend =
+{
+	"logind",
+	logind_set_level
+};
+
+
+
+/*
+ * sysfs backend: write the level straight to the backlight when udev made
+ * it writable for us.  Some drivers take a while, so write from a thread.
+ */
+static void
+sysfs_write_thread (GTask        *task,
+                    gpointer      source_object,
+                    gpointer      task_data,
+                    GCancellable *cancellable)
+{
+	BrightnessOp *op = task_data;
+	gchar buf[16];
+	gint fd, len;
+	gboolean ret = FALSE;
+
+	len = g_snprintf (buf, sizeof (buf), "%i", op->level);
+
+	fd = g_open (op->path, O_WRONLY, 0);
+	if (fd >= 0)
+	{
+		ret = (write (fd, buf, len) == len);
+		close (fd);
+	}
+
+	g_task_return_boolean (task, ret);
+}
+
+static void
+sysfs_write_done_cb (GObject *source, GAsyncResult *res, gpointer data)
+{
+	BrightnessOp *op = data;
+
+	brightness_op_finish (op, g_task_propagate_boolean (G_TASK (res), NULL));
+}
+
+static void
+sysfs_set_level (BatteryBrightness     *brightness,
+                 gint32                 level,
+                 BatteryBrightnessFunc  callback,
+                 gpointer               user_data)
+{
+	BrightnessOp *op;
+	GTask *task;
+
+	op = brightness_op_new (brightness, level, callback, user_data);
+	op->path = g_build_filename (brightness->backlight_dir, "brightness", NULL);
+
+	task = g_task_new (NULL, NULL, sysfs_write_done_cb, op);
+	g_task_set_task_data (task, op, NULL);
+	g_task_run_in_thread (task, sysfs_write_thread);
+	g_object_unref (task);
+}
+
+static const BatteryBrightnessBackend sysfs_backend =
+{
+	"sysfs",
+	sysfs_set_level
+};
+
+
+
+/* Same preference as xfpm-power-backlight-helper: firmware interfaces
+ * first, then platform drivers, then raw GPU controls */
+static gchar *
+find_backlight (void)
+{
+	static const gchar *types[] = { "firmware", "platform", "raw" };
+	const gchar *entry;
+	gchar *best = NULL;
+	guint best_rank = G_N_ELEMENTS (types);
+	GDir *dir;
+
+	dir = g_dir_open (BACKLIGHT_SYSFS_DIR, 0, NULL);
+	if (dir == NULL)
+		return NULL;
+
+	while ((entry = g_dir_read_name (dir)))
+	{
+		gchar *path, *type = NULL;
+		guint rank;
+
+		path = g_build_filename (BACKLIGHT_SYSFS_DIR, entry, "type", NULL);
+		if (g_file_get_contents (path, &type, NULL, NULL))
+		{
+			g_strstrip (type);
+
+			for (rank = 0; rank < best_rank; rank++)
+			{
+				if (g_strcmp0 (type, types[rank]) == 0)
+				{
+					g_free (best);
+					best = g_strdup (entry);
+					best_rank = rank;
+					break;
+				}
+			}
+		}
+
+		g_free (type);
+		g_free (path);
+	}
+
+	g_dir_close (dir);
+
+	return best;
+}
+
+static gint32
+read_level_fd (gint fd)
+{
+	gchar buf[16];
+	gssize len;
+
+	if (lseek (fd, 0, SEEK_SET) < 0)
+		return -1;
+
+	len = read (fd, buf, sizeof (buf) - 1);
+	if (len <= 0)
+		return -1;
+
+	buf[len] = '\0';
+
+	return (gint32) strtol (buf, NULL, 10);
+}
+
+static gint32
+read_level_file (BatteryBrightness *brightness, const gchar *name)
+{
+	gchar *path;
+	gint32 level = -1;
+	gint fd;
+
+	if (brightness->backlight_dir == NULL)
+		return -1;
+
+	path = g_build_filename (brightness->backlight_dir, name, NULL);
+
+	fd = g_open (path, O_RDONLY, 0);
+	if (fd >= 0)
+	{
+		level = read_level_fd (fd);
+		close (fd);
+	}
+
+	g_free (path);
+
+	return level;
+}
+
+static gboolean
+level_changed_cb (gint fd, GIOCondition condition, gpointer data)
+{
+	BatteryBrightness *brightness = data;
+	gint32 level;
+
+	/* reading it again also re-arms the notification */
+	level = read_level_fd (fd);
+
+	if (level >= 0 && brightness->level_func)
+		brightness->level_func (level, brightness->level_func_data);
+
+	return G_SOURCE_CONTINUE;
+}
+
+static void
+stop_level_watch (BatteryBrightness *brightness)
+{
+	if (brightness->level_watch_id)
+	{
+		g_source_remove (brightness->level_watch_id);
+		brightness->level_watch_id = 0;
+	}
+
+	if (brightness->level_fd >= 0)
+	{
+		close (brightness->level_fd);
+		brightness->level_fd = -1;
+	}
+}
+
+static void
+start_level_watch (BatteryBrightness *brightness)
+{
+	gchar *path;
+
+	if (brightness->level_fd >= 0 || brightness->backlight_dir == NULL)
+		return;
+
+	path = g_build_filename (brightness->backlight_dir, "actual_brightness", NULL);
+	brightness->level_fd = g_open (path, O_RDONLY, 0);
+	g_free (path);
+
+	if (brightness->level_fd < 0)
+		return;
+
+	/* The backlight class calls sysfs_notify () on actual_brightness for
+	 * hotkeys and for every write to brightness, which wakes up poll ()
+	 * with an exceptional condition once the file was read */
+	read_level_fd (brightness->level_fd);
+	brightness->level_watch_id = g_unix_fd_add (brightness->level_fd,
+	                                            G_IO_PRI | G_IO_ERR,
+	                                            level_changed_cb, brightness);
+}
+
+static gboolean
+logind_is_running (void)
+{
+	/* the same test as sd_booted () */
+	return g_file_test ("/run/systemd/seats", G_FILE_TEST_IS_DIR);
+}
+
+BatteryBrightness *
+battery_brightness_new (void)
+{
+	BatteryBrightness *brightness;
+
+	brightness = g_new0 (BatteryBrightness, 1);
+	brightness->cancellable = g_cancellable_new ();
+	brightness->backlight_name = find_backlight ();
+	brightness->max_level = -1;
+	brightness->level_fd = -1;
+	brightness->pending_level = -1;
+
+	if (brightness->backlight_name)
+	{
+		gchar *path;
+
+		brightness->backlight_dir = g_build_filename (BACKLIGHT_SYSFS_DIR, brightness->backlight_name, NULL);
+
+		/* never changes for a given backlight */
+		brightness->max_level = read_level_file (brightness, "max_brightness");
+
+		path = g_build_filename (brightness->backlight_dir, "brightness", NULL);
+		if (g_access (path, W_OK) == 0)
+			brightness->backend = &sysfs_backend;
+		g_free (path);
+
+		/* the device backend may not use the system bus, so don't
+		 * wait for the connection here */
+		if (brightness->backend == NULL && logind_is_running ())
+		{
+			brightness->backend = &logind_backend;
+			g_bus_get (G_BUS_TYPE_SYSTEM, brightness->cancellable, system_bus_ready_cb, brightness);
+		}
+	}
+
+	/* also needed if logind turns out to be unusable */
+	brightness->pkexec = g_find_program_in_path ("pkexec");
+
+	if (brightness->backend == NULL)
+		brightness->backend = &helper_backend;
+
+	return brightness;
+}
+
+void
+battery_brightness_free (BatteryBrightness *brightness)
+{
+	if (brightness == NULL)
+		return;
+
+	stop_level_watch (brightness);
+
+	g_cancellable_cancel (brightness->cancellable);
+	g_object_unref (brightness->cancellable);
+
+	if (brightness->bus_wait_op)
+		brightness_op_free (brightness->bus_wait_op);
+
+	if (brightness->system_bus)
+		g_object_unref (brightness->system_bus);
+
+	g_free (brightness->pkexec);
+	g_free (brightness->backlight_dir);
+	g_free (brightness->backlight_name);
+	g_free (brightness);
+}
+
+const gchar *
+battery_brightness_get_backend_name (BatteryBrightness *brightness)
+{
+	g_return_val_if_fail (brightness != NULL, NULL);
+
+	return brightness->backend->name;
+}
+
+void
+battery_brightness_set_level (BatteryBrightness     *brightness,
+                              gint32                 level,
+                              BatteryBrightnessFunc  callback,
+                              gpointer               user_data)
+{
+	g_return_if_fail (brightness != NULL);
+
+	brightness->backend->set_level (brightness, level, callback, user_data);
+}
+
+gint32
+battery_brightness_get_max_level (BatteryBrightness *brightness)
+{
+	g_return_val_if_fail (brightness != NULL, -1);
+
+	return brightness->max_level;
+}
+
+gint32
+battery_brightness_get_level (BatteryBrightness *brightness)
+{
+	g_return_val_if_fail (brightness != NULL, -1);
+
+	if (brightness->level_fd >= 0)
+		return read_level_fd (brightness->level_fd);
+
+	return read_level_file (brightness, "actual_brightness");
+}
+
+/* The backlight is only watched while @func is set */
+void
+battery_brightness_set_level_func (BatteryBrightness          *brightness,
+                                   BatteryBrightnessLevelFunc  func,
+                                   gpointer                    user_data)
+{
+	g_return_if_fail (brightness != NULL);
+
+	brightness->level_func = func;
+	brightness->level_func_data = user_data;
+
+	if (func)
+		start_level_watch (brightness);
+	else
+		stop_level_watch (brightness);
+}
+
+static void start_pending_write (BatteryBrightness *brightness);
+
+static void
+request_done_cb (gboolean success, gpointer data)
+{
+	BatteryBrightness *brightness = data;
+	gint64 latency;
+
+	latency = g_get_monotonic_time () - brightness->in_flight_time;
+
+	brightness->in_flight = FALSE;
+	brightness->stats.n_writes++;
+	brightness->stats.last_latency = latency;
+	battery_histogram_add (&brightness->stats.latency, latency);
+
+	DBG ("brightness write through %s %s after %" G_GINT64_FORMAT " us",
+	     brightness->backend->name, success ? "done" : "failed", latency);
+
+	start_pending_write (brightness);
+}
+
+static void
+start_pending_write (BatteryBrightness *brightness)
+{
+	gint32 level;
+
+	if (brightness->in_flight || brightness->pending_level < 0)
+		return;
+
+	level = brightness->pending_level;
+
+	brightness->in_flight = TRUE;
+	brightness->in_flight_time = brightness->pending_time;
+	brightness->pending_level = -1;
+
+	brightness->backend->set_level (brightness, level, request_done_cb, brightness);
+}
+
+/**
+ * battery_brightness_request_level:
+ *
+ * Ask for @level to be written.  Writes never overlap; a request made
+ * while one is in flight replaces any earlier request still waiting,
+ * so a fast drag only writes the positions the backend can keep up with
+ * and always ends on the last one.
+ **/
+void
+battery_brightness_request_level (BatteryBrightness *brightness, gint32 level)
+{
+	g_return_if_fail (brightness != NULL);
+
+	if (brightness->pending_level >= 0)
+		brightness->stats.n_dropped++;
+
+	brightness->pending_level = level;
+	brightness->pending_time = g_get_monotonic_time ();
+
+	start_pending_write (brightness);
+}
+
+gboolean
+battery_brightness_is_busy (BatteryBrightness *brightness)
+{
+	g_return_val_if_fail (brightness != NULL, FALSE);
+
+	return brightness->in_flight || brightness->pending_level >= 0;
+}
+
+void
+battery_brightness_get_stats (BatteryBrightness *brightness, BatteryBrightnessStats *stats)
+{
+	g_return_if_fail (brightness != NULL);
+
+	*stats = brightness->stats;
+}
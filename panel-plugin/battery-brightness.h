@@ -0,0 +1,89 @@
+/*
+ *  Copyright (C) 2015-2019 Gooroom <gooroom@gooroom.kr>
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef __BATTERY_BRIGHTNESS_H__
+#define __BATTERY_BRIGHTNESS_H__
+
+#include <glib.h>
+
+#include "battery-stats.h"
+
+G_BEGIN_DECLS
+
+typedef struct _BatteryBrightness        BatteryBrightness;
+typedef struct _BatteryBrightnessBackend BatteryBrightnessBackend;
+
+/* Called from the main loop once a write finished */
+typedef void (*BatteryBrightnessFunc) (gboolean success, gpointer user_data);
+
+/* Called when the backlight level changed, by us or anyone else */
+typedef void (*BatteryBrightnessLevelFunc) (gint32 level, gpointer user_data);
+
+/* From request to completed write, and how many requests were replaced
+ * by a newer one before being written */
+typedef struct
+{
+	guint64          n_writes;
+	guint64          n_dropped;
+	guint64          n_spawns;      /* Helper processes started */
+	gint64           last_latency;
+	BatteryHistogram latency;
+} BatteryBrightnessStats;
+
+struct _BatteryBrightnessBackend
+{
+	const gchar *name;
+
+	/* Start writing @level and return right away, @callback is invoked
+	 * unless the BatteryBrightness is freed first */
+	void (*set_level) (BatteryBrightness     *brightness,
+	                   gint32                 level,
+	                   BatteryBrightnessFunc  callback,
+	                   gpointer               user_data);
+};
+
+BatteryBrightness *battery_brightness_new              (void);
+
+void               battery_brightness_free             (BatteryBrightness     *brightness);
+
+const gchar       *battery_brightness_get_backend_name (BatteryBrightness     *brightness);
+
+gint32             battery_brightness_get_max_level    (BatteryBrightness     *brightness);
+
+gint32             battery_brightness_get_level        (BatteryBrightness     *brightness);
+
+void               battery_brightness_set_level_func   (BatteryBrightness     *brightness,
+                                                        BatteryBrightnessLevelFunc func,
+                                                        gpointer               user_data);
+
+void               battery_brightness_request_level    (BatteryBrightness     *brightness,
+                                                        gint32                 level);
+
+gboolean           battery_brightness_is_busy          (BatteryBrightness     *brightness);
+
+void               battery_brightness_get_stats        (BatteryBrightness     *brightness,
+                                                        BatteryBrightnessStats *stats);
+
+void               battery_brightness_set_level        (BatteryBrightness     *brightness,
+                                                        gint32                 level,
+                                                        BatteryBrightnessFunc  callback,
+                                                        gpointer               user_data);
+
+G_END_DECLS
+
+#endif /* !__BATTERY_BRIGHTNESS_H__ */
@@ -0,0 +1,565 @@
+/*
+ *  Copyright (C) 2015-2019 Gooroom <gooroom@gooroom.kr>
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <glib.h>
+#include <gio/gio.h>
+
+#include <libxfce4util/libxfce4util.h>
+
+#include "xfpm-power-common.h"
+#include "battery-dbus.h"
+
+#define DBUS_PROPERTIES_IFACE   "org.freedesktop.DBus.Properties"
+
+
+/* libupower-glib keeps a GDBusProxy per device and turns each
+ * PropertiesChanged into one GObject notify per property, about thirty
+ * of them with a GValue each.  Here a single match rule, limited to
+ * the device interface, covers all devices; each signal is decoded once
+ * straight into the device's snapshot and properties nothing shows are
+ * skipped without being converted. */
+typedef struct
+{
+	BatteryBackend           parent;
+
+	GDBusConnection         *connection;
+
+	guint                    properties_changed_id;
+	guint                    device_added_id;
+	guint                    device_removed_id;
+
+	/* upowerd restarting forgets its devices, they are read again once
+	 * it is back */
+	guint                    watch_id;
+	gboolean                 name_lost;
+
+	/* 0 if upowerd has no display device */
+	GQuark                   display_path;
+
+	/* XfpmDeviceSnapshots indexed by the GQuark of their object path */
+	GHashTable              *devices;
+
+	/* Cancelled on free so pending calls don't call back */
+	GCancellable            *cancellable;
+
+	/* Startup replies still to come: GetDisplayDevice, EnumerateDevices
+	 * and the GetAll of every device they return */
+	guint                    n_startup_calls;
+
+	BatteryBackendReadyFunc  ready_func;
+	gpointer                 ready_data;
+} BatteryDbus;
+
+/* One call to upowerd */
+typedef struct
+{
+	BatteryDbus *dbus;       /* Only valid if not cancelled */
+	gchar       *object_path; /* NULL for the device lists */
+	gboolean     startup;    /* Part of the initial enumeration */
+} DeviceCall;
+
+
+static void
+ready (BatteryDbus *dbus, gboolean success)
+{
+	BatteryBackendReadyFunc func = dbus->ready_func;
+
+	dbus->ready_func = NULL;
+
+	if (func)
+		func (success, dbus->ready_data);
+}
+
+static void
+startup_call_done (BatteryDbus *dbus)
+{
+	if (--dbus->n_startup_calls == 0)
+		ready (dbus, TRUE);
+}
+
+static gboolean
+is_cancelled (GError *error)
+{
+	if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+		return FALSE;
+
+	g_error_free (error);
+	return TRUE;
+}
+
+/* Fold a{sv} into @snapshot, returns the most important field seen */
+static XfpmSnapshotField
+update_snapshot (XfpmDeviceSnapshot *snapshot, GVariantIter *iter)
+{
+	XfpmSnapshotField changed = XFPM_SNAPSHOT_FIELD_NONE;
+	const gchar *name;
+	GVariant *value;
+
+	while (g_variant_iter_next (iter, "{&sv}", &name, &value))
+	{
+		XfpmSnapshotField field = xfpm_device_snapshot_update (snapshot, name, value);
+
+		if (field == XFPM_SNAPSHOT_FIELD_STATUS)
+			changed = field;
+		else if (field == XFPM_SNAPSHOT_FIELD_DETAILS && changed == XFPM_SNAPSHOT_FIELD_NONE)
+			changed = field;
+
+		g_variant_unref (value);
+	}
+
+	return changed;
+}
+
+static DeviceCall *
+device_call_new (BatteryDbus *dbus, const gchar *object_path, gboolean startup)
+{
+	DeviceCall *call = g_new0 (DeviceCall, 1);
+
+	call->dbus = dbus;
+	call->object_path = g_strdup (object_path);
+	call->startup = startup;
+
+	if (startup)
+		dbus->n_startup_calls++;
+
+	return call;
+}
+
+static void
+device_call_free (DeviceCall *call)
+{
+	g_free (call->object_path);
+	g_free (call);
+}
+
+static void
+add_device (BatteryDbus *dbus, const gchar *object_path, GVariant *reply)
+{
+	XfpmDeviceSnapshot *snapshot;
+	GVariantIter *iter;
+	GQuark quark;
+
+	quark = g_quark_from_string (object_path);
+
+	/* don't add the same device twice */
+	if (g_hash_table_contains (dbus->devices, GUINT_TO_POINTER (quark)))
+		return;
+
+	snapshot = g_new0 (XfpmDeviceSnapshot, 1);
+	snapshot->icon_name = snapshot->vendor = snapshot->model = g_intern_static_string ("");
+	snapshot->is_display = (quark == dbus->display_path);
+
+	g_variant_get (reply, "(a{sv})", &iter);
+	update_snapshot (snapshot, iter);
+	g_variant_iter_free (iter);
+
+	g_hash_table_insert (dbus->devices, GUINT_TO_POINTER (quark), snapshot);
+
+	battery_backend_emit (&dbus->parent, BATTERY_BACKEND_ADDED, object_path);
+}
+
+static void
+get_all_cb (GObject *source, GAsyncResult *res, gpointer data)
+{
+	DeviceCall *call = data;
+	GVariant *reply;
+	GError *error = NULL;
+
+	reply = g_dbus_connection_call_finish (G_DBUS_CONNECTION (source), res, &error);
+	if (reply == NULL)
+	{
+		if (is_cancelled (error))
+			goto out;
+
+		/* gone before we got to it */
+		DBG ("Unable to get the properties of %s: %s", call->object_path, error->message);
+		g_error_free (error);
+	}
+	else
+	{
+		add_device (call->dbus, call->object_path, reply);
+		g_variant_unref (reply);
+	}
+
+	if (call->startup)
+		startup_call_done (call->dbus);
+
+out:
+	device_call_free (call);
+}
+
+static void
+get_device (BatteryDbus *dbus, const gchar *object_path, gboolean startup)
+{
+	DeviceCall *call = device_call_new (dbus, object_path, startup);
+
+	g_dbus_connection_call (dbus->connection, UPOWER_NAME, object_path,
+	                        DBUS_PROPERTIES_IFACE, "GetAll",
+	                        g_variant_new ("(s)", UPOWER_IFACE_DEVICE),
+	                        G_VARIANT_TYPE ("(a{sv})"), G_DBUS_CALL_FLAGS_NONE, -1,
+	                        dbus->cancellable, get_all_cb, call);
+}
+
+static void
+properties_changed_cb (GDBusConnection *connection,
+                       const gchar     *sender_name,
+                       const gchar     *object_path,
+                       const gchar     *interface_name,
+                       const gchar     *signal_name,
+                       GVariant        *parameters,
+                       gpointer         data)
+{
+	BatteryDbus *dbus = data;
+	XfpmDeviceSnapshot *snapshot;
+	XfpmSnapshotField changed;
+	GVariantIter *iter;
+
+	/* not added yet, its GetAll reply will be newer than this */
+	snapshot = g_hash_table_lookup (dbus->devices,
+	                                GUINT_TO_POINTER (g_quark_try_string (object_path)));
+	if (snapshot == NULL)
+		return;
+
+	if (!g_variant_is_of_type (parameters, G_VARIANT_TYPE ("(sa{sv}as)")))
+		return;
+
+	g_variant_get (parameters, "(&sa{sv}as)", NULL, &iter, NULL);
+	changed = update_snapshot (snapshot, iter);
+	g_variant_iter_free (iter);
+
+	if (changed == XFPM_SNAPSHOT_FIELD_STATUS)
+		battery_backend_emit (&dbus->parent, BATTERY_BACKEND_CHANGED, object_path);
+	else if (changed == XFPM_SNAPSHOT_FIELD_DETAILS)
+		battery_backend_emit (&dbus->parent, BATTERY_BACKEND_CHANGED_DETAILS, object_path);
+}
+
+static void
+device_added_cb (GDBusConnection *connection,
+                 const gchar     *sender_name,
+                 const gchar     *object_path,
+                 const gchar     *interface_name,
+                 const gchar     *signal_name,
+                 GVariant        *parameters,
+                 gpointer         data)
+{
+	const gchar *device_path;
+
+	if (!g_variant_is_of_type (parameters, G_VARIANT_TYPE ("(o)")))
+		return;
+
+	g_variant_get (parameters, "(&o)", &device_path);
+	get_device (data, device_path, FALSE);
+}
+
+static void
+device_removed_cb (GDBusConnection *connection,
+                   const gchar     *sender_name,
+                   const gchar     *object_path,
+                   const gchar     *interface_name,
+                   const gchar     *signal_name,
+                   GVariant        *parameters,
+                   gpointer         data)
+{
+	BatteryDbus *dbus = data;
+	const gchar *device_path;
+
+	if (!g_variant_is_of_type (parameters, G_VARIANT_TYPE ("(o)")))
+		return;
+
+	g_variant_get (parameters, "(&o)", &device_path);
+
+	if (g_hash_table_remove (dbus->devices, GUINT_TO_POINTER (g_quark_try_string (device_path))))
+		battery_backend_emit (&dbus->parent, BATTERY_BACKEND_REMOVED, device_path);
+}
+
+static void
+enumerate_devices_cb (GObject *source, GAsyncResult *res, gpointer data)
+{
+	DeviceCall *call = data;
+	GVariant *reply;
+	GVariantIter *iter;
+	const gchar *path;
+	GError *error = NULL;
+
+	reply = g_dbus_connection_call_finish (G_DBUS_CONNECTION (source), res, &error);
+	if (reply == NULL)
+	{
+		if (is_cancelled (error))
+			goto out;
+
+		g_warning ("Unable to get the UPower devices: %s", error->message);
+		g_error_free (error);
+
+		if (call->startup)
+			ready (call->dbus, FALSE);
+		goto out;
+	}
+
+	/* all at once, each device is added as soon as its reply is in */
+	g_variant_get (reply, "(ao)", &iter);
+	while (g_variant_iter_next (iter, "&o", &path))
+		get_device (call->dbus, path, call->startup);
+	g_variant_iter_free (iter);
+	g_variant_unref (reply);
+
+	if (call->startup)
+		startup_call_done (call->dbus);
+
+out:
+	device_call_free (call);
+}
+
+static void
+get_display_device_cb (GObject *source, GAsyncResult *res, gpointer data)
+{
+	DeviceCall *call = data;
+	GVariant *reply;
+	const gchar *path;
+	GError *error = NULL;
+
+	reply = g_dbus_connection_call_finish (G_DBUS_CONNECTION (source), res, &error);
+	if (reply == NULL)
+	{
+		if (is_cancelled (error))
+			goto out;
+
+		/* upowerd is not running */
+		g_warning ("Unable to connect to UPower: %s", error->message);
+		g_error_free (error);
+
+		if (call->startup)
+			ready (call->dbus, FALSE);
+		goto out;
+	}
+
+	g_variant_get (reply, "(&o)", &path);
+	if (g_strcmp0 (path, "/") != 0)
+	{
+		call->dbus->display_path = g_quark_from_string (path);
+		get_device (call->dbus, path, call->startup);
+	}
+	g_variant_unref (reply);
+
+	if (call->startup)
+		startup_call_done (call->dbus);
+
+out:
+	device_call_free (call);
+}
+
+/* Nothing waits for anything else: both lists are asked for at once and
+ * every GetAll goes out as soon as its path is known, so with any number
+ * of devices this takes about two round trips */
+static void
+get_devices (BatteryDbus *dbus, gboolean startup)
+{
+	g_dbus_connection_call (dbus->connection, UPOWER_NAME, UPOWER_PATH,
+	                        UPOWER_IFACE, "GetDisplayDevice", NULL,
+	                        G_VARIANT_TYPE ("(o)"), G_DBUS_CALL_FLAGS_NONE, -1,
+	                        dbus->cancellable, get_display_device_cb,
+	                        device_call_new (dbus, NULL, startup));
+
+	g_dbus_connection_call (dbus->connection, UPOWER_NAME, UPOWER_PATH,
+	                        UPOWER_IFACE, "EnumerateDevices", NULL,
+	                        G_VARIANT_TYPE ("(ao)"), G_DBUS_CALL_FLAGS_NONE, -1,
+	                        dbus->cancellable, enumerate_devices_cb,
+	                        device_call_new (dbus, NULL, startup));
+}
+
+static void
+name_vanished_cb (GDBusConnection *connection, const gchar *name, gpointer data)
+{
+	BatteryDbus *dbus = data;
+	GList *paths, *l;
+
+	dbus->name_lost = TRUE;
+	dbus->display_path = 0;
+
+	/* the device paths of the old daemon mean nothing to a new one */
+	paths = g_hash_table_get_keys (dbus->devices);
+	for (l = paths; l != NULL; l = l->next)
+	{
+		g_hash_table_remove (dbus->devices, l->data);
+		battery_backend_emit (&dbus->parent, BATTERY_BACKEND_REMOVED,
+		                      g_quark_to_string (GPOINTER_TO_UINT (l->data)));
+	}
+
+	DBG ("UPower went away, %u devices removed", g_list_length (paths));
+
+	g_list_free (paths);
+}
+
+static void
+name_appeared_cb (GDBusConnection *connection,
+                  const gchar     *name,
+                  const gchar     *name_owner,
+                  gpointer         data)
+{
+	BatteryDbus *dbus = data;
+
+	/* the first owner is already being asked by the startup calls */
+	if (!dbus->name_lost)
+		return;
+
+	dbus->name_lost = FALSE;
+
+	DBG ("UPower is back as %s", name_owner);
+
+	get_devices (dbus, FALSE);
+}
+
+static void
+bus_ready_cb (GObject *source, GAsyncResult *res, gpointer data)
+{
+	BatteryDbus *dbus;
+	GDBusConnection *connection;
+	GError *error = NULL;
+
+	connection = g_bus_get_finish (res, &error);
+	if (connection == NULL)
+	{
+		if (is_cancelled (error))
+			return;
+
+		g_warning ("Unable to connect to the system bus: %s", error->message);
+		g_error_free (error);
+
+		ready (data, FALSE);
+		return;
+	}
+
+	dbus = data;
+	dbus->connection = connection;
+
+	/* subscribe first so no change between the calls below and their
+	 * replies is lost */
+	dbus->properties_changed_id =
+		g_dbus_connection_signal_subscribe (connection, UPOWER_NAME,
+		                                    DBUS_PROPERTIES_IFACE, "PropertiesChanged",
+		                                    NULL, UPOWER_IFACE_DEVICE,
+		                                    G_DBUS_SIGNAL_FLAGS_NONE,
+		                                    properties_changed_cb, dbus, NULL);
+	dbus->device_added_id =
+		g_dbus_connection_signal_subscribe (connection, UPOWER_NAME,
+		                                    UPOWER_IFACE, "DeviceAdded", UPOWER_PATH, NULL,
+		                                    G_DBUS_SIGNAL_FLAGS_NONE,
+		                                    device_added_cb, dbus, NULL);
+	dbus->device_removed_id =
+		g_dbus_connection_signal_subscribe (connection, UPOWER_NAME,
+		                                    UPOWER_IFACE, "DeviceRemoved", UPOWER_PATH, NULL,
+		                                    G_DBUS_SIGNAL_FLAGS_NONE,
+		                                    device_removed_cb, dbus, NULL);
+
+	dbus->watch_id =
+		g_bus_watch_name_on_connection (connection, UPOWER_NAME,
+		                                G_BUS_NAME_WATCHER_FLAGS_NONE,
+		                                name_appeared_cb, name_vanished_cb,
+		                                dbus, NULL);
+
+	get_devices (dbus, TRUE);
+}
+
+static void
+dbus_enumerate (BatteryBackend          *backend,
+                BatteryBackendReadyFunc  callback,
+                gpointer                 user_data)
+{
+	BatteryDbus *dbus = (BatteryDbus *) backend;
+
+	dbus->ready_func = callback;
+	dbus->ready_data = user_data;
+
+	g_bus_get (G_BUS_TYPE_SYSTEM, dbus->cancellable, bus_ready_cb, dbus);
+}
+
+static const gchar *
+dbus_get_display_device (BatteryBackend *backend)
+{
+	BatteryDbus *dbus = (BatteryDbus *) backend;
+
+	if (!g_hash_table_contains (dbus->devices, GUINT_TO_POINTER (dbus->display_path)))
+		return NULL;
+
+	return g_quark_to_string (dbus->display_path);
+}
+
+static gboolean
+dbus_get_snapshot (BatteryBackend     *backend,
+                   const gchar        *object_path,
+                   XfpmDeviceSnapshot *snapshot)
+{
+	BatteryDbus *dbus = (BatteryDbus *) backend;
+	XfpmDeviceSnapshot *current;
+
+	current = g_hash_table_lookup (dbus->devices,
+	                               GUINT_TO_POINTER (g_quark_try_string (object_path)));
+	if (current == NULL)
+		return FALSE;
+
+	*snapshot = *current;
+
+	return TRUE;
+}
+
+static void
+dbus_free (BatteryBackend *backend)
+{
+	BatteryDbus *dbus = (BatteryDbus *) backend;
+
+	/* pending calls finish with G_IO_ERROR_CANCELLED and leave us alone */
+	g_cancellable_cancel (dbus->cancellable);
+	g_object_unref (dbus->cancellable);
+
+	if (dbus->connection)
+	{
+		g_dbus_connection_signal_unsubscribe (dbus->connection, dbus->properties_changed_id);
+		g_dbus_connection_signal_unsubscribe (dbus->connection, dbus->device_added_id);
+		g_dbus_connection_signal_unsubscribe (dbus->connection, dbus->device_removed_id);
+		g_bus_unwatch_name (dbus->watch_id);
+		g_object_unref (dbus->connection);
+	}
+
+	g_hash_table_destroy (dbus->devices);
+
+	g_free (dbus);
+}
+
+static const BatteryBackendClass dbus_class = {
+	"dbus",
+	dbus_enumerate,
+	dbus_get_snapshot,
+	dbus_get_display_device,
+	dbus_free,
+};
+
+BatteryBackend *
+battery_dbus_new (void)
+{
+	BatteryDbus *dbus;
+
+	dbus = g_new0 (BatteryDbus, 1);
+	dbus->parent.klass = &dbus_class;
+	dbus->devices = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, g_free);
+	dbus->cancellable = g_cancellable_new ();
+
+	return &dbus->parent;
+}
@@ -0,0 +1,200 @@
+/*
+ *  Copyright (C) 2015-2019 Gooroom <gooroom@gooroom.kr>
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <gtk/gtk.h>
+
+#include "battery-icon-cache.h"
+
+
+/* A small LRU of loaded icons shared by the tray, the popup rows and the
+ * devices.  Keys are (icon name, pixel size); the icon name is interned
+ * so keys compare by pointer.  GTK 2 has no scale factor to key on. */
+
+typedef struct
+{
+	const gchar *icon_name;
+	gint         size;
+} IconKey;
+
+typedef struct
+{
+	IconKey      key;
+	GdkPixbuf   *pix;               /* NULL if the theme has no such icon */
+	GList       *link;              /* Position in the LRU queue */
+} IconEntry;
+
+struct _BatteryIconCache
+{
+	GtkIconTheme *icon_theme;
+	gulong        changed_signal_id;
+
+	GHashTable   *entries;          /* IconKey -> IconEntry */
+	GQueue        lru;              /* Most recently used first */
+	guint         max_entries;
+
+	guint64       hits;
+	guint64       misses;
+};
+
+
+static guint
+icon_key_hash (gconstpointer data)
+{
+	const IconKey *key = data;
+
+	return g_direct_hash (key->icon_name) ^ (key->size << 8);
+}
+
+static gboolean
+icon_key_equal (gconstpointer a, gconstpointer b)
+{
+	const IconKey *key_a = a;
+	const IconKey *key_b = b;
+
+	return key_a->icon_name == key_b->icon_name
+	    && key_a->size == key_b->size;
+}
+
+static void
+icon_entry_free (gpointer data)
+{
+	IconEntry *entry = data;
+
+	if (entry->pix != NULL)
+		g_object_unref (entry->pix);
+
+	g_free (entry);
+}
+
+static void
+icon_theme_changed_cb (GtkIconTheme *icon_theme, BatteryIconCache *cache)
+{
+	battery_icon_cache_clear (cache);
+}
+
+BatteryIconCache *
+battery_icon_cache_new (GtkIconTheme *icon_theme, guint max_entries)
+{
+	BatteryIconCache *cache;
+
+	g_return_val_if_fail (GTK_IS_ICON_THEME (icon_theme), NULL);
+	g_return_val_if_fail (max_entries > 0, NULL);
+
+	cache = g_new0 (BatteryIconCache, 1);
+	cache->icon_theme = g_object_ref (icon_theme);
+	cache->entries = g_hash_table_new_full (icon_key_hash, icon_key_equal, NULL, icon_entry_free);
+	cache->max_entries = max_entries;
+	g_queue_init (&cache->lru);
+
+	/* A new theme means every cached pixbuf may be stale */
+	cache->changed_signal_id = g_signal_connect (icon_theme, "changed",
+	                                             G_CALLBACK (icon_theme_changed_cb), cache);
+
+	return cache;
+}
+
+void
+battery_icon_cache_free (BatteryIconCache *cache)
+{
+	if (cache == NULL)
+		return;
+
+	g_signal_handler_disconnect (cache->icon_theme, cache->changed_signal_id);
+	g_object_unref (cache->icon_theme);
+
+	g_queue_clear (&cache->lru);
+	g_hash_table_destroy (cache->entries);
+
+	g_free (cache);
+}
+
+/* Returns a new reference to the icon, or NULL if the theme has none */
+GdkPixbuf *
+battery_icon_cache_lookup (BatteryIconCache *cache, const gchar *icon_name, gint size)
+{
+	IconEntry *entry;
+	IconKey key;
+
+	g_return_val_if_fail (cache != NULL, NULL);
+
+	if (icon_name == NULL)
+		return NULL;
+
+	key.icon_name = g_intern_string (icon_name);
+	key.size = size;
+
+	entry = g_hash_table_lookup (cache->entries, &key);
+	if (entry != NULL)
+	{
+		cache->hits++;
+
+		/* move to the front */
+		g_queue_unlink (&cache->lru, entry->link);
+		g_queue_push_head_link (&cache->lru, entry->link);
+
+		return entry->pix != NULL ? g_object_ref (entry->pix) : NULL;
+	}
+
+	cache->misses++;
+
+	entry = g_new0 (IconEntry, 1);
+	entry->key = key;
+	entry->pix = gtk_icon_theme_load_icon (cache->icon_theme,
+	                                       icon_name,
+	                                       size,
+	                                       GTK_ICON_LOOKUP_FORCE_SIZE,
+	                                       NULL);
+
+	/* drop the least recently used icon */
+	if (g_queue_get_length (&cache->lru) >= cache->max_entries)
+	{
+		IconEntry *oldest = g_queue_pop_tail (&cache->lru);
+		g_hash_table_remove (cache->entries, &oldest->key);
+	}
+
+	g_queue_push_head (&cache->lru, entry);
+	entry->link = g_queue_peek_head_link (&cache->lru);
+	g_hash_table_insert (cache->entries, &entry->key, entry);
+
+	return entry->pix != NULL ? g_object_ref (entry->pix) : NULL;
+}
+
+void
+battery_icon_cache_clear (BatteryIconCache *cache)
+{
+	g_return_if_fail (cache != NULL);
+
+	g_queue_clear (&cache->lru);
+	g_hash_table_remove_all (cache->entries);
+}
+
+void
+battery_icon_cache_get_stats (BatteryIconCache *cache, guint64 *hits, guint64 *misses)
+{
+	g_return_if_fail (cache != NULL);
+
+	if (hits != NULL)
+		*hits = cache->hits;
+	if (misses != NULL)
+		*misses = cache->misses;
+}
@@ -0,0 +1,45 @@
+/*
+ *  Copyright (C) 2015-2019 Gooroom <gooroom@gooroom.kr>
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef __BATTERY_ICON_CACHE_H__
+#define __BATTERY_ICON_CACHE_H__
+
+#include <gtk/gtk.h>
+
+G_BEGIN_DECLS
+
+typedef struct _BatteryIconCache BatteryIconCache;
+
+BatteryIconCache *battery_icon_cache_new       (GtkIconTheme     *icon_theme,
+                                                guint             max_entries);
+
+void              battery_icon_cache_free      (BatteryIconCache *cache);
+
+GdkPixbuf        *battery_icon_cache_lookup    (BatteryIconCache *cache,
+                                                const gchar      *icon_name,
+                                                gint              size);
+
+void              battery_icon_cache_clear     (BatteryIconCache *cache);
+
+void              battery_icon_cache_get_stats (BatteryIconCache *cache,
+                                                guint64          *hits,
+                                                guint64          *misses);
+
+G_END_DECLS
+
+#endif /* !__BATTERY_ICON_CACHE_H__ */
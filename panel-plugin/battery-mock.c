@@ -0,0 +1,346 @@
+/*
+ *  Copyright (C) 2015-2019 Gooroom <gooroom@gooroom.kr>
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+
+#include <glib.h>
+
+#include <upower.h>
+
+#include "battery-mock.h"
+
+
+#define MOCK_PATH_PREFIX        UPOWER_PATH_DEVICE "mock_"
+
+/* How often scripted changes are fired, in milliseconds */
+#define MOCK_TICK_INTERVAL      (10)
+
+
+typedef struct
+{
+	gchar              *object_path;
+	XfpmDeviceSnapshot  snapshot;
+} MockDevice;
+
+struct _BatteryMock
+{
+	BatteryBackend      parent;
+
+	/* MockDevices in the order they were added, and by object path */
+	GPtrArray          *devices;
+	GHashTable         *device_table;
+	guint               next_id;
+
+	gchar              *display_path;
+	gboolean            enumerated;     /* ADDED events are sent */
+
+	/* Changes fired so far, and the ones running at a fixed rate */
+	guint64             n_changes;
+	guint               per_second;
+	guint               timeout_id;
+	gint64              changes_start;
+	guint64             changes_fired;
+};
+
+
+static void
+mock_device_free (gpointer data)
+{
+	MockDevice *device = data;
+
+	g_free (device->object_path);
+	g_free (device);
+}
+
+static void
+mock_emit (BatteryMock *mock, BatteryBackendEvent event, const gchar *object_path)
+{
+	/* devices added before enumerate () are reported by it */
+	if (mock->enumerated)
+		battery_backend_emit (&mock->parent, event, object_path);
+}
+
+static void
+mock_enumerate (BatteryBackend          *backend,
+                BatteryBackendReadyFunc  callback,
+                gpointer                 user_data)
+{
+	BatteryMock *mock = (BatteryMock *) backend;
+	guint i;
+
+	mock->enumerated = TRUE;
+
+	for (i = 0; i < mock->devices->len; i++)
+	{
+		MockDevice *device = g_ptr_array_index (mock->devices, i);
+
+		battery_backend_emit (backend, BATTERY_BACKEND_ADDED, device->object_path);
+	}
+
+	callback (TRUE, user_data);
+}
+
+static gboolean
+mock_get_snapshot (BatteryBackend     *backend,
+                   const gchar        *object_path,
+                   XfpmDeviceSnapshot *snapshot)
+{
+	BatteryMock *mock = (BatteryMock *) backend;
+	MockDevice *device;
+
+	device = g_hash_table_lookup (mock->device_table, object_path);
+	if (device == NULL)
+		return FALSE;
+
+	*snapshot = device->snapshot;
+	snapshot->is_display = g_strcmp0 (object_path, mock->display_path) == 0;
+
+	return TRUE;
+}
+
+static const gchar *
+mock_get_display_device (BatteryBackend *backend)
+{
+	return ((BatteryMock *) backend)->display_path;
+}
+
+static void
+mock_free (BatteryBackend *backend)
+{
+	BatteryMock *mock = (BatteryMock *) backend;
+
+	battery_mock_stop_changes (mock);
+
+	g_hash_table_destroy (mock->device_table);
+	g_ptr_array_free (mock->devices, TRUE);
+	g_free (mock->display_path);
+	g_free (mock);
+}
+
+static const BatteryBackendClass mock_class = {
+	"mock",
+	mock_enumerate,
+	mock_get_snapshot,
+	mock_get_display_device,
+	mock_free,
+};
+
+BatteryMock *
+battery_mock_new (void)
+{
+	BatteryMock *mock;
+
+	mock = g_new0 (BatteryMock, 1);
+	mock->parent.klass = &mock_class;
+	mock->devices = g_ptr_array_new_with_free_func (mock_device_free);
+	mock->device_table = g_hash_table_new (g_str_hash, g_str_equal);
+
+	return mock;
+}
+
+BatteryBackend *
+battery_mock_get_backend (BatteryMock *mock)
+{
+	return &mock->parent;
+}
+
+/**
+ * battery_mock_add_device:
+ *
+ * Returns: the object path of the new device, owned by @mock
+ **/
+const gchar *
+battery_mock_add_device (BatteryMock *mock, const XfpmDeviceSnapshot *snapshot)
+{
+	MockDevice *device;
+
+	device = g_new0 (MockDevice, 1);
+	device->object_path = g_strdup_printf (MOCK_PATH_PREFIX "%u", mock->next_id++);
+	device->snapshot = *snapshot;
+
+	g_ptr_array_add (mock->devices, device);
+	g_hash_table_insert (mock->device_table, device->object_path, device);
+
+	mock_emit (mock, BATTERY_BACKEND_ADDED, device->object_path);
+
+	return device->object_path;
+}
+
+/**
+ * battery_mock_add_batteries:
+ *
+ * Add @n_devices discharging batteries with different charges.
+ **/
+void
+battery_mock_add_batteries (BatteryMock *mock, guint n_devices)
+{
+	XfpmDeviceSnapshot snapshot;
+	guint i;
+
+	memset (&snapshot, 0, sizeof (snapshot));
+	snapshot.kind = UP_DEVICE_KIND_BATTERY;
+	snapshot.state = UP_DEVICE_STATE_DISCHARGING;
+	snapshot.icon_name = g_intern_static_string ("battery-good-symbolic");
+	snapshot.vendor = g_intern_static_string ("Mock");
+	snapshot.model = g_intern_static_string ("Battery");
+
+	for (i = 0; i < n_devices; i++)
+	{
+		snapshot.percentage = 100 - (gint) ((mock->next_id * 7) % 100);
+		snapshot.time_to_empty = snapshot.percentage * 3;
+
+		battery_mock_add_device (mock, &snapshot);
+	}
+}
+
+gboolean
+battery_mock_change_device (BatteryMock              *mock,
+                            const gchar              *object_path,
+                            const XfpmDeviceSnapshot *snapshot)
+{
+	MockDevice *device;
+
+	device = g_hash_table_lookup (mock->device_table, object_path);
+	if (device == NULL)
+		return FALSE;
+
+	device->snapshot = *snapshot;
+	mock->n_changes++;
+
+	mock_emit (mock, BATTERY_BACKEND_CHANGED, device->object_path);
+
+	return TRUE;
+}
+
+gboolean
+battery_mock_remove_device (BatteryMock *mock, const gchar *object_path)
+{
+	MockDevice *device;
+
+	device = g_hash_table_lookup (mock->device_table, object_path);
+	if (device == NULL)
+		return FALSE;
+
+	g_hash_table_remove (mock->device_table, device->object_path);
+
+	mock_emit (mock, BATTERY_BACKEND_REMOVED, device->object_path);
+
+	g_ptr_array_remove (mock->devices, device);
+
+	return TRUE;
+}
+
+void
+battery_mock_remove_all (BatteryMock *mock)
+{
+	while (mock->devices->len > 0)
+	{
+		MockDevice *device = g_ptr_array_index (mock->devices, mock->devices->len - 1);
+
+		battery_mock_remove_device (mock, device->object_path);
+	}
+}
+
+void
+battery_mock_set_display_device (BatteryMock *mock, const gchar *object_path)
+{
+	g_free (mock->display_path);
+	mock->display_path = g_strdup (object_path);
+}
+
+guint
+battery_mock_get_n_devices (BatteryMock *mock)
+{
+	return mock->devices->len;
+}
+
+/**
+ * battery_mock_step:
+ *
+ * Fire @n_changes changes right away, one device after the other.
+ * Every change lowers the charge of the device by one percent.
+ **/
+void
+battery_mock_step (BatteryMock *mock, guint n_changes)
+{
+	guint i;
+
+	for (i = 0; i < n_changes && mock->devices->len > 0; i++)
+	{
+		MockDevice *device;
+		XfpmDeviceSnapshot snapshot;
+
+		device = g_ptr_array_index (mock->devices, mock->n_changes % mock->devices->len);
+
+		snapshot = device->snapshot;
+		snapshot.percentage = (snapshot.percentage + 100) % 101;
+		snapshot.time_to_empty = snapshot.percentage * 3;
+
+		battery_mock_change_device (mock, device->object_path, &snapshot);
+	}
+}
+
+static gboolean
+changes_timeout_cb (gpointer data)
+{
+	BatteryMock *mock = data;
+	guint64 due;
+
+	/* catch up with the wall clock, so a late tick doesn't lower the rate */
+	due = (guint64) mock->per_second * (g_get_monotonic_time () - mock->changes_start) / G_USEC_PER_SEC;
+
+	battery_mock_step (mock, (guint) (due - mock->changes_fired));
+	mock->changes_fired = due;
+
+	return G_SOURCE_CONTINUE;
+}
+
+void
+battery_mock_start_changes (BatteryMock *mock, guint per_second)
+{
+	battery_mock_stop_changes (mock);
+
+	if (per_second == 0)
+		return;
+
+	mock->per_second = per_second;
+	mock->changes_start = g_get_monotonic_time ();
+	mock->changes_fired = 0;
+	mock->timeout_id = g_timeout_add (MOCK_TICK_INTERVAL, changes_timeout_cb, mock);
+}
+
+void
+battery_mock_stop_changes (BatteryMock *mock)
+{
+	if (mock->timeout_id)
+	{
+		g_source_remove (mock->timeout_id);
+		mock->timeout_id = 0;
+	}
+}
+
+guint64
+battery_mock_get_n_changes (BatteryMock *mock)
+{
+	return mock->n_changes;
+}
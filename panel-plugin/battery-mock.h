@@ -0,0 +1,69 @@
+/*
+ *  Copyright (C) 2015-2019 Gooroom <gooroom@gooroom.kr>
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef __BATTERY_MOCK_H__
+#define __BATTERY_MOCK_H__
+
+#include <glib.h>
+
+#include "battery-backend.h"
+#include "xfpm-power-common.h"
+
+G_BEGIN_DECLS
+
+/* A backend driven by the caller, for tests and benchmarks.  Given the
+ * same calls it always produces the same devices and events. */
+typedef struct _BatteryMock BatteryMock;
+
+BatteryMock    *battery_mock_new                (void);
+
+BatteryBackend *battery_mock_get_backend        (BatteryMock              *mock);
+
+const gchar    *battery_mock_add_device         (BatteryMock              *mock,
+                                                 const XfpmDeviceSnapshot *snapshot);
+
+void            battery_mock_add_batteries      (BatteryMock              *mock,
+                                                 guint                     n_devices);
+
+gboolean        battery_mock_change_device      (BatteryMock              *mock,
+                                                 const gchar              *object_path,
+                                                 const XfpmDeviceSnapshot *snapshot);
+
+gboolean        battery_mock_remove_device      (BatteryMock              *mock,
+                                                 const gchar              *object_path);
+
+void            battery_mock_remove_all         (BatteryMock              *mock);
+
+void            battery_mock_set_display_device (BatteryMock              *mock,
+                                                 const gchar              *object_path);
+
+guint           battery_mock_get_n_devices      (BatteryMock              *mock);
+
+void            battery_mock_step               (BatteryMock              *mock,
+                                                 guint                     n_changes);
+
+void            battery_mock_start_changes      (BatteryMock              *mock,
+                                                 guint                     per_second);
+
+void            battery_mock_stop_changes       (BatteryMock              *mock);
+
+guint64         battery_mock_get_n_changes      (BatteryMock              *mock);
+
+G_END_DECLS
+
+#endif /* !__BATTERY_MOCK_H__ */
@@ -0,0 +1,583 @@
+/*
+ *  Copyright (C) 2015-2019 Gooroom <gooroom@gooroom.kr>
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <glib.h>
+
+#include <libxfce4util/libxfce4util.h>
+#include <upower.h>
+
+#include "battery-model.h"
+
+
+#define DISPLAY_RANKS           (101)
+
+/* Dropping to this percentage is shown without waiting for a flush,
+ * the xfce4-power-manager default critical level */
+#define CRITICAL_PERCENTAGE     (10)
+
+/* Flushes run right before GDK redraws (GDK_PRIORITY_REDRAW - 10),
+ * without depending on GDK */
+#define FLUSH_PRIORITY          (G_PRIORITY_HIGH_IDLE + 10)
+
+
+struct _BatteryModel
+{
+	const BatteryModelListener *listener;
+	gpointer                    user_data;
+
+	BatteryBackend             *backend;
+
+	/* BatteryModelDevices, the last one moves into the slot of a removed
+	 * one, and the same devices indexed by the GQuark of their object path */
+	GPtrArray                  *devices;
+	GHashTable                 *device_table;
+
+	/* The device shown in the tray and the candidates for it, by percentage */
+	BatteryModelDevice         *display_device;
+	GQueue                      ranks[DISPLAY_RANKS];
+
+	/* Devices waiting for the next flush, and its source */
+	GQueue                      dirty_devices;
+	guint                       flush_id;
+
+	/* Seconds between flushes, 0 flushes as soon as the loop is idle */
+	guint                       flush_interval;
+
+	BatteryModelStats           stats;
+};
+
+
+/* Without a composite device from UPower the battery or ups with the
+ * highest percentage is used for the tray.  Candidates are kept in one
+ * queue per whole percent, so finding the best one never depends on the
+ * number of devices. */
+static void
+display_candidate_update (BatteryModel *model, BatteryModelDevice *device)
+{
+	gint rank = -1;
+
+	if (device->has_snapshot &&
+	    (device->snapshot.kind == UP_DEVICE_KIND_BATTERY ||
+	     device->snapshot.kind == UP_DEVICE_KIND_UPS) &&
+	    device->snapshot.percentage > 0)
+	{
+		rank = MIN (device->snapshot.percentage, DISPLAY_RANKS - 1);
+	}
+
+	if (rank == device->rank)
+		return;
+
+	if (device->rank >= 0)
+		g_queue_delete_link (&model->ranks[device->rank], device->rank_link);
+
+	device->rank = rank;
+	device->rank_link = NULL;
+
+	if (rank >= 0)
+	{
+		g_queue_push_tail (&model->ranks[rank], device);
+		device->rank_link = g_queue_peek_tail_link (&model->ranks[rank]);
+	}
+}
+
+static void
+display_candidate_remove (BatteryModel *model, BatteryModelDevice *device)
+{
+	if (device->rank >= 0)
+		g_queue_delete_link (&model->ranks[device->rank], device->rank_link);
+
+	device->rank = -1;
+	device->rank_link = NULL;
+}
+
+static BatteryModelDevice *
+select_display_device (BatteryModel *model)
+{
+	BatteryModelDevice *device;
+	const gchar *display_path;
+	gint rank;
+
+	display_path = battery_backend_get_display_device (model->backend);
+	if (display_path)
+	{
+		device = battery_model_find_device (model, display_path);
+		if (device)
+			return device;
+	}
+
+	for (rank = DISPLAY_RANKS - 1; rank >= 0; rank--)
+	{
+		if (!g_queue_is_empty (&model->ranks[rank]))
+			return g_queue_peek_head (&model->ranks[rank]);
+	}
+
+	return NULL;
+}
+
+/* @changed is the device that was just updated, or NULL if only the
+ * selection may have changed */
+static void
+update_display_device (BatteryModel *model, BatteryModelDevice *changed)
+{
+	BatteryModelDevice *device;
+
+	device = select_display_device (model);
+
+	if (device == model->display_device && device != changed)
+		return;
+
+	model->display_device = device;
+
+	if (device != NULL && !device->has_snapshot)
+		return;
+
+	model->listener->display_changed (device, model->user_data);
+}
+
+static gboolean
+read_snapshot (BatteryModel *model, BatteryModelDevice *device, XfpmDeviceSnapshot *snapshot)
+{
+	return battery_backend_get_snapshot (model->backend,
+	                                     g_quark_to_string (device->object_path),
+	                                     snapshot);
+}
+
+/* Line power going away, starting to discharge or dropping to the
+ * critical level */
+static gboolean
+is_critical_change (const XfpmDeviceSnapshot *old, const XfpmDeviceSnapshot *new)
+{
+	if (old->kind == UP_DEVICE_KIND_LINE_POWER)
+		return old->online && !new->online;
+
+	if (new->state == UP_DEVICE_STATE_DISCHARGING && old->state != UP_DEVICE_STATE_DISCHARGING)
+		return TRUE;
+
+	return old->percentage > CRITICAL_PERCENTAGE && new->percentage <= CRITICAL_PERCENTAGE;
+}
+
+/* Listeners and the device list only see devices with a snapshot */
+static void
+announce_device (BatteryModel *model, BatteryModelDevice *device)
+{
+	device->index = model->devices->len;
+	g_ptr_array_add (model->devices, device);
+
+	display_candidate_update (model, device);
+
+	model->listener->device_added (device, model->user_data);
+
+	update_display_device (model, device);
+}
+
+static void
+apply_snapshot (BatteryModel *model, BatteryModelDevice *device, const XfpmDeviceSnapshot *snapshot)
+{
+	/* Nothing visible changed (energy-rate, voltage, ...), keep what we have */
+	if (device->has_snapshot && xfpm_device_snapshot_equal (&device->snapshot, snapshot))
+	{
+		model->stats.n_unchanged++;
+		return;
+	}
+
+	device->snapshot = *snapshot;
+
+	/* The first snapshot of a device that couldn't be read when it was added */
+	if (!device->has_snapshot)
+	{
+		device->has_snapshot = TRUE;
+		announce_device (model, device);
+		return;
+	}
+
+	/* The display device may now be this one */
+	display_candidate_update (model, device);
+	update_display_device (model, device);
+
+	model->listener->device_changed (device, model->user_data);
+}
+
+static void
+refresh_device (BatteryModel *model, BatteryModelDevice *device)
+{
+	XfpmDeviceSnapshot snapshot;
+
+	device->dirty = FALSE;
+
+	if (read_snapshot (model, device, &snapshot))
+		apply_snapshot (model, device, &snapshot);
+}
+
+static gboolean
+flush_cb (gpointer data)
+{
+	BatteryModel *model = data;
+
+	model->flush_id = 0;
+	battery_model_flush (model);
+
+	return FALSE;
+}
+
+/* Throttled flushes share their wakeup with the other second timers */
+static void
+schedule_flush (BatteryModel *model)
+{
+	if (model->flush_id)
+		return;
+
+	if (model->flush_interval == 0)
+		model->flush_id = g_idle_add_full (FLUSH_PRIORITY, flush_cb, model, NULL);
+	else
+		model->flush_id = g_timeout_add_seconds (model->flush_interval, flush_cb, model);
+}
+
+static void
+unqueue_device (BatteryModel *model, BatteryModelDevice *device)
+{
+	if (!device->dirty)
+		return;
+
+	g_queue_delete_link (&model->dirty_devices, device->dirty_link);
+	device->dirty_link = NULL;
+	device->dirty = FALSE;
+}
+
+/* A critical change is shown right away, whatever the flush interval,
+ * and anything queued for the device goes with it.  Only a changed state,
+ * online or percentage can be one, so only those cost an extra snapshot
+ * read.  @arrival is when the event came in. */
+static gboolean
+refresh_if_critical (BatteryModel *model, BatteryModelDevice *device, gint64 arrival)
+{
+	XfpmDeviceSnapshot snapshot;
+
+	if (!device->has_snapshot)
+		return FALSE;
+
+	if (!read_snapshot (model, device, &snapshot) || !is_critical_change (&device->snapshot, &snapshot))
+		return FALSE;
+
+	unqueue_device (model, device);
+	apply_snapshot (model, device, &snapshot);
+
+	model->stats.n_critical++;
+	battery_histogram_add (&model->stats.critical_latency, g_get_monotonic_time () - arrival);
+
+	return TRUE;
+}
+
+static void
+device_changed (BatteryModel *model, BatteryModelDevice *device, gboolean details_only)
+{
+	gint64 arrival = g_get_monotonic_time ();
+
+	model->stats.n_notifies++;
+
+	if (!details_only && refresh_if_critical (model, device, arrival))
+		return;
+
+	/* UPower emits one notify per changed property, all of them are
+	 * folded into a single refresh of the device before the next redraw */
+	if (device->dirty)
+	{
+		model->stats.n_notifies_coalesced++;
+		return;
+	}
+
+	device->dirty = TRUE;
+	device->dirty_time = arrival;
+	g_queue_push_tail (&model->dirty_devices, device);
+	device->dirty_link = g_queue_peek_tail_link (&model->dirty_devices);
+
+	schedule_flush (model);
+}
+
+static void
+add_device (BatteryModel *model, const gchar *object_path)
+{
+	BatteryModelDevice *device;
+
+	/* don't add the same device twice */
+	if (battery_model_find_device (model, object_path) != NULL)
+		return;
+
+	device = g_new0 (BatteryModelDevice, 1);
+	device->rank = -1;
+	device->object_path = g_quark_from_string (object_path);
+	device->has_snapshot = read_snapshot (model, device, &device->snapshot);
+
+	g_hash_table_insert (model->device_table, GUINT_TO_POINTER (device->object_path), device);
+
+	/* Otherwise it is announced by the first refresh that can read it */
+	if (device->has_snapshot)
+		announce_device (model, device);
+}
+
+static void
+remove_device (BatteryModel *model, const gchar *object_path)
+{
+	BatteryModelDevice *device;
+	gboolean was_display_device;
+
+	device = battery_model_find_device (model, object_path);
+	if (device == NULL)
+		return;
+
+	was_display_device = (model->display_device == device);
+
+	/* Don't flush a device that is gone */
+	unqueue_device (model, device);
+	display_candidate_remove (model, device);
+
+	g_hash_table_remove (model->device_table, GUINT_TO_POINTER (device->object_path));
+
+	/* Keep the order of the others, the popup rows follow it */
+	if (device->has_snapshot)
+	{
+		guint i;
+
+		g_ptr_array_remove_index (model->devices, device->index);
+		for (i = device->index; i < model->devices->len; i++)
+			((BatteryModelDevice *) g_ptr_array_index (model->devices, i))->index = i;
+
+		model->listener->device_removed (device, model->user_data);
+	}
+
+	g_free (device);
+
+	/* Another device may take over the tray */
+	if (was_display_device)
+	{
+		model->display_device = NULL;
+		update_display_device (model, NULL);
+	}
+}
+
+static void
+backend_event_cb (BatteryBackendEvent event, const gchar *object_path, gpointer data)
+{
+	BatteryModel *model = data;
+	BatteryModelDevice *device;
+
+	switch (event)
+	{
+		case BATTERY_BACKEND_ADDED:
+			add_device (model, object_path);
+			break;
+
+		case BATTERY_BACKEND_CHANGED:
+		case BATTERY_BACKEND_CHANGED_DETAILS:
+			device = battery_model_find_device (model, object_path);
+			if (device)
+				device_changed (model, device, event == BATTERY_BACKEND_CHANGED_DETAILS);
+			break;
+
+		case BATTERY_BACKEND_REMOVED:
+			remove_device (model, object_path);
+			break;
+	}
+}
+
+BatteryModel *
+battery_model_new (const BatteryModelListener *listener, gpointer user_data)
+{
+	BatteryModel *model;
+	guint i;
+
+	model = g_new0 (BatteryModel, 1);
+	model->listener = listener;
+	model->user_data = user_data;
+	model->devices = g_ptr_array_new ();
+	model->device_table = g_hash_table_new (g_direct_hash, g_direct_equal);
+
+	g_queue_init (&model->dirty_devices);
+	for (i = 0; i < DISPLAY_RANKS; i++)
+		g_queue_init (&model->ranks[i]);
+
+	return model;
+}
+
+void
+battery_model_free (BatteryModel *model)
+{
+	if (model == NULL)
+		return;
+
+	battery_model_remove_all (model);
+
+	g_ptr_array_free (model->devices, TRUE);
+	g_hash_table_destroy (model->device_table);
+	g_free (model);
+}
+
+/**
+ * battery_model_set_backend:
+ *
+ * Follow the events of @backend, which stays owned by the caller.  Its
+ * devices are added once it is enumerated.
+ **/
+void
+battery_model_set_backend (BatteryModel *model, BatteryBackend *backend)
+{
+	model->backend = backend;
+
+	if (backend)
+		battery_backend_subscribe (backend, backend_event_cb, model);
+}
+
+BatteryModelDevice *
+battery_model_find_device (BatteryModel *model, const gchar *object_path)
+{
+	GQuark quark;
+
+	/* A path that was never interned can't be in the table */
+	quark = g_quark_try_string (object_path);
+	if (quark == 0)
+		return NULL;
+
+	return g_hash_table_lookup (model->device_table, GUINT_TO_POINTER (quark));
+}
+
+guint
+battery_model_get_n_devices (BatteryModel *model)
+{
+	return model->devices->len;
+}
+
+BatteryModelDevice *
+battery_model_get_device (BatteryModel *model, guint index)
+{
+	return g_ptr_array_index (model->devices, index);
+}
+
+BatteryModelDevice *
+battery_model_get_display_device (BatteryModel *model)
+{
+	return model->display_device;
+}
+
+/**
+ * battery_model_flush:
+ *
+ * Refresh the devices that changed since the last flush right away,
+ * instead of waiting for the idle callback.
+ **/
+void
+battery_model_flush (BatteryModel *model)
+{
+	BatteryModelDevice *device;
+
+	if (model->flush_id)
+	{
+		g_source_remove (model->flush_id);
+		model->flush_id = 0;
+	}
+
+	/* refreshing a device never queues it again */
+	while ((device = g_queue_pop_head (&model->dirty_devices)) != NULL)
+	{
+		gint64 start = g_get_monotonic_time ();
+		gint64 end;
+
+		device->dirty_link = NULL;
+		refresh_device (model, device);
+
+		end = g_get_monotonic_time ();
+		battery_histogram_add (&model->stats.update_time, end - start);
+		battery_histogram_add (&model->stats.queued_latency, end - device->dirty_time);
+	}
+
+	model->stats.n_flushes++;
+
+	DBG ("notifies: %" G_GUINT64_FORMAT ", coalesced: %" G_GUINT64_FORMAT ", flushes: %" G_GUINT64_FORMAT
+	     ", unchanged: %" G_GUINT64_FORMAT,
+	     model->stats.n_notifies, model->stats.n_notifies_coalesced,
+	     model->stats.n_flushes, model->stats.n_unchanged);
+}
+
+/**
+ * battery_model_set_flush_interval:
+ *
+ * Refresh changed devices at most once every @seconds, or right away
+ * for 0.  A pending refresh is moved to the new schedule.
+ **/
+void
+battery_model_set_flush_interval (BatteryModel *model, guint seconds)
+{
+	if (model->flush_interval == seconds)
+		return;
+
+	model->flush_interval = seconds;
+
+	if (model->flush_id)
+	{
+		g_source_remove (model->flush_id);
+		model->flush_id = 0;
+		schedule_flush (model);
+	}
+}
+
+void
+battery_model_remove_all (BatteryModel *model)
+{
+	GHashTableIter iter;
+	gpointer value;
+	gboolean had_display_device;
+	guint i;
+
+	if (model->flush_id)
+	{
+		g_source_remove (model->flush_id);
+		model->flush_id = 0;
+	}
+
+	g_queue_clear (&model->dirty_devices);
+
+	for (i = 0; i < DISPLAY_RANKS; i++)
+		g_queue_clear (&model->ranks[i]);
+
+	had_display_device = (model->display_device != NULL);
+	model->display_device = NULL;
+
+	for (i = 0; i < model->devices->len; i++)
+		model->listener->device_removed (g_ptr_array_index (model->devices, i), model->user_data);
+
+	g_ptr_array_set_size (model->devices, 0);
+
+	/* The table also holds the devices that were never announced */
+	g_hash_table_iter_init (&iter, model->device_table);
+	while (g_hash_table_iter_next (&iter, NULL, &value))
+		g_free (value);
+
+	g_hash_table_remove_all (model->device_table);
+
+	if (had_display_device)
+		model->listener->display_changed (NULL, model->user_data);
+}
+
+void
+battery_model_get_stats (BatteryModel *model, BatteryModelStats *stats)
+{
+	*stats = model->stats;
+}
@@ -0,0 +1,118 @@
+/*
+ *  Copyright (C) 2015-2019 Gooroom <gooroom@gooroom.kr>
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef __BATTERY_MODEL_H__
+#define __BATTERY_MODEL_H__
+
+#include <glib.h>
+
+#include "battery-backend.h"
+#include "battery-stats.h"
+#include "xfpm-power-common.h"
+
+G_BEGIN_DECLS
+
+/* The devices of a backend, refreshed in batches, and the one of them
+ * that is shown in the tray.  Knows nothing about widgets. */
+typedef struct _BatteryModel         BatteryModel;
+typedef struct _BatteryModelDevice   BatteryModelDevice;
+typedef struct _BatteryModelListener BatteryModelListener;
+
+struct _BatteryModelDevice
+{
+	GQuark              object_path;    /* Object path from the backend */
+	XfpmDeviceSnapshot  snapshot;       /* The last one that differed */
+	gboolean            has_snapshot;   /* snapshot is valid */
+	gpointer            view_data;      /* Owned by the listener */
+
+	/* private */
+	gboolean            dirty;          /* Waiting for the next flush */
+	GList              *dirty_link;     /* Link in the dirty queue */
+	gint64              dirty_time;     /* When the first queued event came */
+	guint               index;          /* In the model's device array, once announced */
+	gint                rank;           /* Display candidate rank, -1 if none */
+	GList              *rank_link;      /* Link in the queue of its rank */
+};
+
+struct _BatteryModelListener
+{
+	/* The device has its first snapshot; a device that can't be read
+	 * yet is only announced once a refresh succeeds */
+	void (*device_added)    (BatteryModelDevice *device, gpointer user_data);
+
+	/* The snapshot changed in a way that shows */
+	void (*device_changed)  (BatteryModelDevice *device, gpointer user_data);
+
+	/* An announced device is about to be freed */
+	void (*device_removed)  (BatteryModelDevice *device, gpointer user_data);
+
+	/* Another device is shown in the tray, or the shown one changed;
+	 * NULL once the last candidate is gone */
+	void (*display_changed) (BatteryModelDevice *device, gpointer user_data);
+};
+
+/* How many CHANGED events were received, how many of them were folded
+ * into an already pending refresh, how many were critical and went past
+ * the queue and how many refreshes found nothing visible changed.
+ * update_time is how long each device refresh took, the listener
+ * included; the latencies are from the first event to the refresh, for
+ * critical and for queued changes. */
+typedef struct
+{
+	guint64          n_notifies;
+	guint64          n_notifies_coalesced;
+	guint64          n_critical;
+	guint64          n_flushes;
+	guint64          n_unchanged;
+	BatteryHistogram update_time;
+	BatteryHistogram critical_latency;
+	BatteryHistogram queued_latency;
+} BatteryModelStats;
+
+BatteryModel       *battery_model_new                (const BatteryModelListener *listener,
+                                                      gpointer                    user_data);
+
+void                battery_model_free               (BatteryModel               *model);
+
+void                battery_model_set_backend        (BatteryModel               *model,
+                                                      BatteryBackend             *backend);
+
+BatteryModelDevice *battery_model_find_device        (BatteryModel               *model,
+                                                      const gchar                *object_path);
+
+/* The announced devices, in the order they were added */
+guint               battery_model_get_n_devices      (BatteryModel               *model);
+
+BatteryModelDevice *battery_model_get_device         (BatteryModel               *model,
+                                                      guint                       index);
+
+BatteryModelDevice *battery_model_get_display_device (BatteryModel               *model);
+
+void                battery_model_flush              (BatteryModel               *model);
+
+void                battery_model_set_flush_interval (BatteryModel               *model,
+                                                      guint                       seconds);
+
+void                battery_model_remove_all         (BatteryModel               *model);
+
+void                battery_model_get_stats          (BatteryModel               *model,
+                                                      BatteryModelStats          *stats);
+
+G_END_DECLS
+
+#endif /* !__BATTERY_MODEL_H__ */
@@ -25,14 +25,26 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <signal.h>
 
 #include "xfpm-power-common.h"
+#include "battery-icon-cache.h"
+#include "battery-brightness.h"
+#include "battery-supply-monitor.h"
+#include "battery-backend.h"
+#include "battery-model.h"
+#include "battery-stats.h"
+#include "battery-upower.h"
+#include "battery-dbus.h"
+#include "battery-sysfs.h"
+#include "battery-mock.h"
 #include "battery-plugin.h"
 
 #include <gtk/gtk.h>
 #include <gdk/gdkkeysyms.h>
 
 #include <glib-object.h>
+#include <glib-unix.h>
 #include <libxfce4util/libxfce4util.h>
 #include <libxfce4panel/xfce-panel-plugin.h>
 
@@ -42,12 +54,40 @@
 
 
 #define PANEL_TRAY_ICON_SIZE        (24)
-#define SET_BRIGHTNESS_TIMEOUT      (50)
+#define POPUP_DEVICE_ICON_SIZE      (32)
+#define ICON_CACHE_SIZE             (32)
 #define PANEL_DEFAULT_ICON          ("battery-full-charged")
 #define PANEL_DEFAULT_ICON_SYMBOLIC ("battery-full-charged-symbolic")
 
+/* Seconds between refreshes while the popup is closed, overridden by
+ * ac-interval and battery-interval in the plugin's rc file */
+#define AC_FLUSH_INTERVAL           (1)
+#define BATTERY_FLUSH_INTERVAL      (10)
 
 
+
+typedef enum
+{
+	STARTUP_PHASE_SCAN,       /* a battery was found */
+	STARTUP_PHASE_CLIENT,     /* the backend reported a device */
+	STARTUP_PHASE_DEVICES,    /* the devices were added */
+	STARTUP_PHASE_TRAY,       /* the tray shows a device */
+	N_STARTUP_PHASES
+} StartupPhase;
+
+static const gchar *startup_phase_names[] = { "scan", "client", "devices", "tray" };
+
+/* Set up on first use only */
+typedef enum
+{
+	LAZY_INIT_XFCONF,         /* the xfce4-power-manager channel */
+	LAZY_INIT_BRIGHTNESS,     /* backlight and its backend */
+	LAZY_INIT_POPUP,          /* the popup window, includes the two above */
+	N_LAZY_INITS
+} LazyInit;
+
+static const gchar *lazy_init_names[] = { "xfconf", "brightness", "popup" };
+
 struct _BatteryPluginClass
 {
   XfcePanelPluginClass __parent__;
@@ -67,29 +107,59 @@ struct _BatteryPlugin
     GtkWidget       *img_tray;
 
 	XfconfChannel   *channel;
+	gboolean         xfconf_failed;
+
+    /* Where the devices come from, UPower unless it is not running */
+	BatteryBackend  *backend;
+
+    /* The backend when it is sysfs, it follows the monitor's uevents */
+	BatterySysfs    *sysfs;
+
+    /* Shows the button while a battery is present, the backend is only
+     * started once the first battery was seen */
+	BatterySupplyMonitor *supply_monitor;
+
+    /* When each startup phase was reached in microseconds after the
+     * plugin was created */
+	gint64           startup_time;
+	gint64           startup_phases[N_STARTUP_PHASES];
 
-	UpClient        *upower;
+    /* How long each subsystem took on its first use, in microseconds */
+	gint64           lazy_init_times[N_LAZY_INITS];
 
-    /* A list of BatteryDevices  */
-	GList           *devices;
+    /* The backend's devices and which one the tray shows */
+	BatteryModel    *model;
 
-    /* Upower 0.99 has a display device that can be used for the
-     * panel image and tooltip description */
-	UpDevice        *display_device;
+    /* Seconds between refreshes on AC and when discharging, popup closed */
+	guint            ac_interval;
+	guint            battery_interval;
 
     /* Keep track of icon name to redisplay during size changes */
 	gchar           *tray_icon_name;
 
-	guint            set_brightness_timeout;
+    /* Icons shared by the tray and the popup rows */
+	BatteryIconCache *icon_cache;
+	gulong           theme_changed_id;
+
+	BatteryBrightness *brightness;
+
+    /* How many device refreshes waited for the popup to be shown */
+	guint64          n_popup_deferred;
+
+    /* How many popup descriptions were formatted and how long showing
+     * the popup took, dumped with the rest on SIGUSR1 */
+	guint64          n_descriptions;
+	BatteryHistogram popup_open_time;
+	guint            stats_signal_id;
 };
 
 typedef struct
 {
-	GdkPixbuf   *pix;               /* Icon */
+	BatteryPlugin *plugin;          /* The plugin owning the device */
+	BatteryModelDevice *device;     /* The device and its snapshot */
 	gchar       *details;           /* Description of the device + state */
-	gchar       *object_path;       /* UpDevice object path */
-	UpDevice    *device;            /* Pointer to the UpDevice */
-	gulong       changed_signal_id; /* device changed callback id */
+	gchar       *icon_name;         /* Icon shown for the device */
+	gboolean     popup_stale;       /* details and icon_name are outdated */
 
 	GtkWidget   *item_detail;       /* The device's item on the menu (if shown) */
 	GtkWidget   *label_detail;      /* The device's item on the menu (if shown) */
@@ -103,147 +173,15 @@ XFCE_PANEL_DEFINE_PLUGIN (BatteryPlugin, battery_plugin)
 
 
 static gboolean popup_window_add_device (BatteryDevice *battery_device, BatteryPlugin *plugin);
+static void startup_mark (BatteryPlugin *plugin, StartupPhase phase);
+static void lazy_init_mark (BatteryPlugin *plugin, LazyInit what, gint64 start);
+static void popup_window_update_device_icon (BatteryDevice *battery_device, BatteryPlugin *plugin);
+static void update_flush_interval (BatteryPlugin *plugin);
 
 
 
 
 
-static gboolean
-xfpm_brightness_helper_set_level (gint32 level)
-{
-	gboolean ret = FALSE;
-	gint exit_status = 0;
-	gchar *pkexec, *cmdline = NULL;
-
-	pkexec = g_find_program_in_path ("pkexec");
-	cmdline = g_strdup_printf ("%s %s/xfpm-power-backlight-helper --set-brightness %i", pkexec, SBINDIR, level);
-	if (!g_spawn_command_line_sync (cmdline, NULL, NULL, &exit_status, NULL)) {
-		goto out;
-	}
-
-	ret = (exit_status == 0);
-
-out:
-	g_free (cmdline);
-
-	return ret;
-}
-
-static gint
-xfpm_brightness_helper_get_level (const gchar *argument)
-{
-	gint value = -1;
-	gint exit_status = 0;
-	gchar *cmdline, *output = NULL;
-
-	cmdline = g_strdup_printf (SBINDIR "/xfpm-power-backlight-helper --%s", argument);
-	if (!g_spawn_command_line_sync (cmdline, &output, NULL, &exit_status, NULL)) {
-		goto out;
-	}
-
-	if (exit_status != 0)
-		goto out;
-
-	if (output[0] == 'N') {
-		value = 0;
-	} else if (output[0] == 'Y') {
-		value = 1;
-	} else {
-		value = atoi (output);
-	}
-
-out:
-	g_free (cmdline);
-	g_free (output);
-
-	return value;
-}
-
-static GList*
-find_device_in_list (GList *devices, const gchar *object_path)
-{
-	GList *item = NULL;
-
-	g_return_val_if_fail (devices != NULL, NULL);
-
-	for (item = g_list_first (devices); item != NULL; item = g_list_next (item))
-	{
-		BatteryDevice *battery_device = item->data;
-		if (battery_device == NULL)
-		{
-			continue;
-		}
-
-		if (g_strcmp0 (battery_device->object_path, object_path) == 0)
-			return item;
-	}
-
-	return NULL;
-}
-
-static BatteryDevice*
-get_display_device (BatteryPlugin *plugin)
-{
-	GList *item = NULL;
-	gdouble highest_percentage = 0;
-	BatteryDevice *display_device = NULL;
-
-	if (plugin->display_device)
-	{
-		item = find_device_in_list (plugin->devices, up_device_get_object_path (plugin->display_device));
-		if (item)
-		{
-			return item->data;
-		}
-	}
-
-	/* We want to find the battery or ups device with the highest percentage
-	 * and use that to get our tooltip from */
-	for (item = g_list_first (plugin->devices); item != NULL; item = g_list_next (item))
-	{
-		BatteryDevice *battery_device = item->data;
-		guint type = 0;
-		gdouble percentage;
-
-		if (!battery_device->device || !UP_IS_DEVICE (battery_device->device))
-		{
-			continue;
-		}
-
-		g_object_get (battery_device->device,
-				"kind", &type,
-				"percentage", &percentage,
-				NULL);
-
-		if (type == UP_DEVICE_KIND_BATTERY || type == UP_DEVICE_KIND_UPS)
-		{
-			if (highest_percentage < percentage)
-			{
-				display_device = battery_device;
-				highest_percentage = percentage;
-			}
-		}
-	}
-
-	return display_device;
-}
-
-/* This function unrefs the pix and img from the battery device and
- * disconnects the expose-event callback on the img.
- */
-static void
-battery_device_remove_pix (BatteryDevice *battery_device)
-{
-	if (battery_device == NULL)
-		return;
-
-	if (G_IS_OBJECT (battery_device->pix))
-	{
-		g_object_unref (battery_device->pix);
-		battery_device->pix = NULL;
-	}
-}
-
 static void
 remove_battery_device (BatteryDevice *battery_device, BatteryPlugin *plugin)
 {
@@ -256,21 +194,7 @@ remove_battery_device (BatteryDevice *battery_device, BatteryPlugin *plugin)
 	}
 
 	g_free (battery_device->details);
-	g_free (battery_device->object_path);
-
-	battery_device_remove_pix (battery_device);
-
-	if (battery_device->device != NULL && UP_IS_DEVICE(battery_device->device))
-	{
-		/* disconnect the signal handler if we were using it */
-		if (battery_device->changed_signal_id != 0)
-			g_signal_handler_disconnect (battery_device->device, battery_device->changed_signal_id);
-		battery_device->changed_signal_id = 0;
-
-		g_object_unref (battery_device->device);
-		battery_device->device = NULL;
-	}
-
+	g_free (battery_device->icon_name);
 	g_free (battery_device);
 }
 
@@ -278,39 +202,24 @@ static void
 update_tray_icon (BatteryPlugin *plugin)
 {
 	GdkPixbuf *pix = NULL;
-	pix = gtk_icon_theme_load_icon (gtk_icon_theme_get_default (),
-                                    plugin->tray_icon_name,
-                                    PANEL_TRAY_ICON_SIZE,
-                                    GTK_ICON_LOOKUP_FORCE_SIZE,
-                                    NULL);
+	pix = battery_icon_cache_lookup (plugin->icon_cache,
+	                                 plugin->tray_icon_name,
+	                                 PANEL_TRAY_ICON_SIZE);
 
 	if (pix) {
 		gtk_image_set_from_pixbuf (GTK_IMAGE (plugin->img_tray), pix);
 		g_object_unref (pix);
+
+		startup_mark (plugin, STARTUP_PHASE_TRAY);
 	}
 }
 
-
-static void
-update_device_icon_and_details (UpDevice *device, BatteryPlugin *plugin)
+static gchar*
+get_icon_name (const XfpmDeviceSnapshot *snapshot)
 {
-	GList          *item;
-	BatteryDevice  *battery_device;
-	BatteryDevice  *display_device;
-	const gchar    *object_path = up_device_get_object_path (device);
-	gchar          *details;
-	gchar          *icon_name;
-	GdkPixbuf      *pix = NULL;
-
-	item = find_device_in_list (plugin->devices, object_path);
-
-	if (item == NULL)
-		return;
-
-	battery_device = item->data;
+	gchar *icon_name;
 
-	icon_name = get_device_icon_name (plugin->upower, device);
-	details = get_device_description (plugin->upower, device);
+	icon_name = xfpm_device_snapshot_get_icon_name (snapshot);
 
 	/* If UPower doesn't give us an icon, just use the default */
 	if (g_strcmp0 (icon_name, "") == 0)
@@ -323,112 +232,139 @@ update_device_icon_and_details (UpDevice *device, BatteryPlugin *plugin)
 	if (icon_name == NULL)
 		icon_name = g_strdup (PANEL_DEFAULT_ICON);
 
-	pix = gtk_icon_theme_load_icon (gtk_icon_theme_get_default (),
-                                    icon_name,
-                                    32,
-                                    GTK_ICON_LOOKUP_FORCE_SIZE,
-                                    NULL);
-
-	if (battery_device->details)
-		g_free (battery_device->details);
-	battery_device->details = details;
+	return icon_name;
+}
 
-	/* If we had an image before, remove it and the callback */
-	battery_device_remove_pix (battery_device);
-	battery_device->pix = pix;
+/* Show the display device in the tray */
+static void
+model_display_changed_cb (BatteryModelDevice *device, gpointer data)
+{
+	BatteryPlugin *plugin = BATTERY_PLUGIN (data);
+	gchar *icon_name;
+	gchar *tray_icon_name;
 
-	/* Get the display device, which may now be this one */
-	display_device = get_display_device (plugin);
+	/* the device shown is gone and nothing can take its place */
+	if (device == NULL)
+	{
+		tray_icon_name = g_strdup (PANEL_DEFAULT_ICON_SYMBOLIC);
+	}
+	else
+	{
+		icon_name = get_icon_name (&device->snapshot);
+		tray_icon_name = g_strdup_printf ("%s-%s", icon_name, "symbolic");
+		g_free (icon_name);
+	}
 
-	if (battery_device == display_device)
+	/* update the icon */
+	if (g_strcmp0 (plugin->tray_icon_name, tray_icon_name) != 0)
 	{
-		/* update the icon */
 		g_free (plugin->tray_icon_name);
-
-		plugin->tray_icon_name = g_strdup_printf ("%s-%s", icon_name, "symbolic");
+		plugin->tray_icon_name = tray_icon_name;
 
 		update_tray_icon (plugin);
 	}
-	g_free (icon_name);
-
-	/* If the popup window is being displayed, update it */
-	if (plugin->popup_window && battery_device->item_detail)
+	else
 	{
-		gtk_label_set_markup (GTK_LABEL (battery_device->label_detail), details);
-		gtk_image_set_from_pixbuf (GTK_IMAGE (battery_device->icon_detail), battery_device->pix);
+		g_free (tray_icon_name);
 	}
+
+	/* we may have gone on or off AC */
+	update_flush_interval (plugin);
 }
 
-static gboolean
-set_brightness_level_with_timeout (gpointer data)
+/* Bring the popup-only parts of the device, its description and row
+ * icon, up to date with its snapshot */
+static void
+popup_window_refresh_device (BatteryDevice *battery_device, BatteryPlugin *plugin)
 {
-	BatteryPlugin *plugin = BATTERY_PLUGIN (data);
+	gchar *icon_name;
+
+	if (!battery_device->popup_stale)
+		return;
+
+	battery_device->popup_stale = FALSE;
 
-	gint32 value;
+	g_free (battery_device->details);
+	battery_device->details = xfpm_device_snapshot_get_description (&battery_device->device->snapshot);
+	plugin->n_descriptions++;
 
-	value = (gint32) gtk_range_get_value (GTK_RANGE (plugin->scl_brightness));
+	icon_name = get_icon_name (&battery_device->device->snapshot);
 
-	xfpm_brightness_helper_set_level (value);
+	/* Only touch the image if the icon itself changed */
+	if (g_strcmp0 (battery_device->icon_name, icon_name) != 0)
+	{
+		g_free (battery_device->icon_name);
+		battery_device->icon_name = icon_name;
 
-	if (plugin->set_brightness_timeout) {
-		g_source_remove (plugin->set_brightness_timeout);
-		plugin->set_brightness_timeout = 0;
+		if (battery_device->item_detail)
+			popup_window_update_device_icon (battery_device, plugin);
+	}
+	else
+	{
+		g_free (icon_name);
 	}
 
-	return FALSE;
+	if (battery_device->item_detail)
+	{
+		gtk_label_set_markup (GTK_LABEL (battery_device->label_detail), battery_device->details);
+	}
+}
+
+static gboolean
+popup_window_is_visible (BatteryPlugin *plugin)
+{
+	return plugin->popup_window != NULL && gtk_widget_get_visible (plugin->popup_window);
 }
 
+/* Refreshes are immediate while the popup is shown; otherwise they are
+ * batched on second timers, less often when running on battery */
 static void
-on_brightness_changed_cb (GtkWidget *widget, gpointer data)
+update_flush_interval (BatteryPlugin *plugin)
 {
-	BatteryPlugin *plugin = BATTERY_PLUGIN (data);
+	BatteryModelDevice *display_device;
+	guint interval = plugin->ac_interval;
 
-	if (plugin->set_brightness_timeout)
-		return;
+	display_device = battery_model_get_display_device (plugin->model);
 
-	plugin->set_brightness_timeout =
-		g_timeout_add (SET_BRIGHTNESS_TIMEOUT,
-		(GSourceFunc) set_brightness_level_with_timeout, plugin);
+	if (popup_window_is_visible (plugin))
+		interval = 0;
+	else if (display_device != NULL && display_device->has_snapshot &&
+	         (display_device->snapshot.state == UP_DEVICE_STATE_DISCHARGING ||
+	          display_device->snapshot.state == UP_DEVICE_STATE_PENDING_DISCHARGE))
+		interval = plugin->battery_interval;
+
+	battery_model_set_flush_interval (plugin->model, interval);
 }
 
 static void
-device_changed_cb (UpDevice *device, GParamSpec *pspec, BatteryPlugin *plugin)
+model_device_changed_cb (BatteryModelDevice *device, gpointer data)
 {
-	update_device_icon_and_details (device, plugin);
+	BatteryPlugin *plugin = BATTERY_PLUGIN (data);
+	BatteryDevice *battery_device = device->view_data;
+
+	/* The rest is only seen in the popup, while it is hidden the
+	 * work waits until it is shown again */
+	battery_device->popup_stale = TRUE;
+
+	if (popup_window_is_visible (plugin))
+		popup_window_refresh_device (battery_device, plugin);
+	else
+		plugin->n_popup_deferred++;
 }
 
 static void
-add_device (UpDevice *device, BatteryPlugin *plugin)
+model_device_added_cb (BatteryModelDevice *device, gpointer data)
 {
+	BatteryPlugin *plugin = BATTERY_PLUGIN (data);
 	BatteryDevice *battery_device;
-	guint type = 0;
-	const gchar *object_path = up_device_get_object_path (device);
-	gulong signal_id;
-	gboolean is_present = FALSE;
 
-	/* don't add the same device twice */
-	if (find_device_in_list (plugin->devices, object_path) != NULL)
-		return;
+	startup_mark (plugin, STARTUP_PHASE_CLIENT);
 
 	battery_device = g_new0 (BatteryDevice, 1);
-
-	/* hack, this depends on XFPM_DEVICE_TYPE_* being in sync with UP_DEVICE_KIND_* */
-	g_object_get (device,
-                  "kind", &type,
-                  NULL);
-
-	signal_id = g_signal_connect (device, "notify", G_CALLBACK (device_changed_cb), plugin);
-
-	/* populate the struct */
-	battery_device->object_path = g_strdup (object_path);
-	battery_device->changed_signal_id = signal_id;
-	battery_device->device = g_object_ref (device);
-
-	/* add it to the list */
-	plugin->devices = g_list_append (plugin->devices, battery_device);
-
-	/* Add the icon and description for the device */
-	update_device_icon_and_details (device, plugin);
+	battery_device->plugin = plugin;
+	battery_device->device = device;
+	battery_device->popup_stale = TRUE;
+	device->view_data = battery_device;
 
 	/* If the menu is being shown, add this new device to it */
 	if (plugin->popup_window)
@@ -438,89 +374,58 @@ add_device (UpDevice *device, BatteryPlugin *plugin)
 }
 
 static void
-remove_device (const gchar *object_path, BatteryPlugin *plugin)
+model_device_removed_cb (BatteryModelDevice *device, gpointer data)
 {
-	GList *item;
-	BatteryDevice *battery_device;
-
-	item = find_device_in_list (plugin->devices, object_path);
-
-	if (item == NULL)
-		return;
-
-	battery_device = item->data;
-
-	/* Remove its resources */
-	remove_battery_device (battery_device, plugin);
-
-	/* remove it item and free the battery device */
-	plugin->devices = g_list_delete_link (plugin->devices, item);
+	remove_battery_device (device->view_data, BATTERY_PLUGIN (data));
+	device->view_data = NULL;
 }
 
-static void
-add_all_devices (BatteryPlugin *plugin)
-{
-	GPtrArray *array = NULL;
-	guint i;
-
-	plugin->display_device = up_client_get_display_device (plugin->upower);
-
-	add_device (plugin->display_device, plugin);
-
-	array = up_client_get_devices (plugin->upower);
-
-	if (array)
-	{
-		for (i = 0; i < array->len; i++)
-		{
-			UpDevice *device = g_ptr_array_index (array, i);
-
-			add_device (device, plugin);
-		}
-		g_ptr_array_free (array, TRUE);
-	}
-}
+static const BatteryModelListener model_listener = {
+	model_device_added_cb,
+	model_device_changed_cb,
+	model_device_removed_cb,
+	model_display_changed_cb,
+};
 
 static void
-remove_all_devices (BatteryPlugin *plugin)
+on_brightness_changed_cb (GtkWidget *widget, gpointer data)
 {
-	GList *item = NULL;
-
-	for (item = g_list_first (plugin->devices); item != NULL; item = g_list_next (item))
-	{
-		BatteryDevice *battery_device = item->data;
-		if (battery_device == NULL)
-		{
-			continue;
-		}
+	BatteryPlugin *plugin = BATTERY_PLUGIN (data);
 
-		/* Remove its resources */
-		remove_battery_device (battery_device, plugin);
-	}
+	battery_brightness_request_level (plugin->brightness,
+	                                  (gint32) gtk_range_get_value (GTK_RANGE (widget)));
 }
 
 static void
-device_added_cb (UpClient *upower, UpDevice *device, BatteryPlugin *plugin)
+brightness_level_changed_cb (gint32 level, gpointer data)
 {
-	add_device (device, plugin);
-}
+	BatteryPlugin *plugin = BATTERY_PLUGIN (data);
 
-static void
-device_removed_cb (UpClient *upower, const gchar *object_path, BatteryPlugin *plugin)
-{
-	remove_device (object_path, plugin);
+	/* don't fight the slider while our own change is pending */
+	if (plugin->scl_brightness == NULL || battery_brightness_is_busy (plugin->brightness))
+		return;
+
+	g_signal_handlers_block_by_func (plugin->scl_brightness, on_brightness_changed_cb, plugin);
+	gtk_range_set_value (GTK_RANGE (plugin->scl_brightness), level);
+	g_signal_handlers_unblock_by_func (plugin->scl_brightness, on_brightness_changed_cb, plugin);
 }
 
+/* Done once, when the popup is built */
 static void
 setup_brightness (BatteryPlugin *plugin)
 {
 	gint32 step, range;
-	gint32 max_brightness, min_brightness, cur_brightness;
+	gint32 max_brightness, min_brightness;
+	gint64 start;
+
+	/* nothing needs the backlight before the popup is shown */
+	start = g_get_monotonic_time ();
+	plugin->brightness = battery_brightness_new ();
+	lazy_init_mark (plugin, LAZY_INIT_BRIGHTNESS, start);
 
-	max_brightness = (gint32)xfpm_brightness_helper_get_level ("get-max-brightness");
-	cur_brightness = (gint32)xfpm_brightness_helper_get_level ("get-brightness");
+	max_brightness = battery_brightness_get_max_level (plugin->brightness);
 
-	if (max_brightness < 0 || cur_brightness < 0) {
+	if (max_brightness < 0) {
 		gtk_widget_set_sensitive (plugin->scl_brightness, FALSE);
 		return;
 	}
@@ -531,58 +436,76 @@ setup_brightness (BatteryPlugin *plugin)
 
 	gtk_range_set_range (GTK_RANGE (plugin->scl_brightness), min_brightness, max_brightness);
 	gtk_range_set_increments (GTK_RANGE (plugin->scl_brightness), step, step);  
-	gtk_range_set_value (GTK_RANGE (plugin->scl_brightness), cur_brightness);
 
 	g_signal_connect (G_OBJECT (plugin->scl_brightness), "value-changed", G_CALLBACK (on_brightness_changed_cb), plugin);
 }
 
+/* Done each time the popup is shown */
+static void
+update_brightness (BatteryPlugin *plugin)
+{
+	gint32 cur_brightness;
+
+	if (!gtk_widget_get_sensitive (plugin->scl_brightness))
+		return;
+
+	cur_brightness = battery_brightness_get_level (plugin->brightness);
+
+	if (cur_brightness >= 0)
+		brightness_level_changed_cb (cur_brightness, plugin);
+
+	/* follow hotkeys and other programs while the popup is shown */
+	battery_brightness_set_level_func (plugin->brightness, brightness_level_changed_cb, plugin);
+}
+
 static void
 popup_window_destroy_device (GtkWidget *object, gpointer data)
 {
-	BatteryPlugin *plugin = BATTERY_PLUGIN (data);
+	BatteryDevice *battery_device = data;
 
-	GList *item = NULL;
-	for (item = g_list_first (plugin->devices); item != NULL; item = g_list_next (item))
-	{
-		BatteryDevice *battery_device = item->data;
-
-		if (battery_device->item_detail == object)
-		{
-			battery_device->label_detail = NULL;
-			battery_device->icon_detail = NULL;
-			battery_device->separator = NULL;
-			battery_device->item_detail = NULL;
-			return;
-		}
-	}
+	battery_device->label_detail = NULL;
+	battery_device->icon_detail = NULL;
+	battery_device->separator = NULL;
+	battery_device->item_detail = NULL;
+}
+
+static void
+popup_window_update_device_icon (BatteryDevice *battery_device, BatteryPlugin *plugin)
+{
+	GdkPixbuf *pix;
+
+	pix = battery_icon_cache_lookup (plugin->icon_cache,
+	                                 battery_device->icon_name,
+	                                 POPUP_DEVICE_ICON_SIZE);
+
+	gtk_image_set_from_pixbuf (GTK_IMAGE (battery_device->icon_detail), pix);
+
+	if (pix)
+		g_object_unref (pix);
 }
 
 static gboolean
 popup_window_add_device (BatteryDevice *battery_device, BatteryPlugin *plugin)
 {
-	guint type = 0;
 	GtkWidget *label, *icon, *hbox, *separator;
+	const XfpmDeviceSnapshot *snapshot = &battery_device->device->snapshot;
 
-	if (UP_IS_DEVICE (battery_device->device))
+	/* Don't add the display device or line power to the menu */
+	if (snapshot->kind == UP_DEVICE_KIND_LINE_POWER || snapshot->is_display)
 	{
-		g_object_get (battery_device->device,
-				"kind", &type,
-				NULL);
-
-		/* Don't add the display device or line power to the menu */
-		if (type == UP_DEVICE_KIND_LINE_POWER || battery_device->device == plugin->display_device)
-		{
-			return FALSE;
-		}
+		return FALSE;
 	}
 
+	/* it may have changed while the popup was hidden */
+	popup_window_refresh_device (battery_device, plugin);
+
 	hbox = gtk_hbox_new (FALSE, 9);
 	gtk_container_set_border_width (GTK_CONTAINER (hbox), 7);
 	gtk_box_pack_start (GTK_BOX (plugin->box_devices), hbox, TRUE, TRUE, 0);
 	gtk_widget_show (hbox);
 
-	icon = gtk_image_new_from_pixbuf (battery_device->pix);
-	gtk_image_set_pixel_size (GTK_IMAGE (icon), 32);
+	icon = gtk_image_new ();
+	gtk_image_set_pixel_size (GTK_IMAGE (icon), POPUP_DEVICE_ICON_SIZE);
 	gtk_box_pack_start (GTK_BOX (hbox), icon, FALSE, FALSE, 9);
 	gtk_widget_show (icon);
 
@@ -603,7 +526,9 @@ popup_window_add_device (BatteryDevice *battery_device, BatteryPlugin *plugin)
 	battery_device->label_detail = label;
 	battery_device->separator = separator;
 
-	g_signal_connect(G_OBJECT (hbox), "destroy", G_CALLBACK (popup_window_destroy_device), plugin);
+	popup_window_update_device_icon (battery_device, plugin);
+
+	g_signal_connect(G_OBJECT (hbox), "destroy", G_CALLBACK (popup_window_destroy_device), battery_device);
 
 	return TRUE;
 }
@@ -613,10 +538,14 @@ on_popup_window_closed (gpointer data)
 {
 	BatteryPlugin *plugin = BATTERY_PLUGIN (data);
 
-	if (plugin->popup_window != NULL) {
-		gtk_widget_destroy (plugin->popup_window);
-		plugin->popup_window = NULL;
-    }
+	if (plugin->brightness)
+		battery_brightness_set_level_func (plugin->brightness, NULL, NULL);
+
+	/* keep it around for the next time */
+	if (plugin->popup_window != NULL)
+		gtk_widget_hide (plugin->popup_window);
+
+	update_flush_interval (plugin);
 
 	xfce_panel_plugin_block_autohide (XFCE_PANEL_PLUGIN (plugin), FALSE);
 	gtk_toggle_button_set_active (GTK_TOGGLE_BUTTON (plugin->button), FALSE);
@@ -635,6 +564,28 @@ on_popup_key_press_event (GtkWidget *widget, GdkEventKey *event, gpointer data)
 	return FALSE;
 }
 
+/* The channel is only used by the presentation mode button */
+static XfconfChannel *
+popup_window_get_channel (BatteryPlugin *plugin)
+{
+	gint64 start;
+
+	if (plugin->channel || plugin->xfconf_failed)
+		return plugin->channel;
+
+	start = g_get_monotonic_time ();
+
+	if (xfconf_init (NULL)) {
+		plugin->channel = xfconf_channel_get ("xfce4-power-manager");
+	} else {
+		plugin->xfconf_failed = TRUE;
+	}
+
+	lazy_init_mark (plugin, LAZY_INIT_XFCONF, start);
+
+	return plugin->channel;
+}
+
 static void
 on_popup_window_realized (GtkWidget *widget, gpointer data)
 {
@@ -645,8 +596,10 @@ on_popup_window_realized (GtkWidget *widget, gpointer data)
 	gtk_window_move (GTK_WINDOW (widget), x, y);
 }
 
+/* Built on the first click and kept until the plugin goes away; device
+ * rows are added and removed as devices come and go */
 static GtkWidget *
-popup_window_new (BatteryPlugin *plugin, GdkEventButton *event)
+popup_window_new (BatteryPlugin *plugin)
 {
 	GtkWidget *window;
 
@@ -679,11 +632,11 @@ popup_window_new (BatteryPlugin *plugin, GdkEventButton *event)
 	plugin->box_devices = gtk_vbox_new (FALSE, 0);
 	gtk_box_pack_start (GTK_BOX (main_vbox), plugin->box_devices, FALSE, FALSE, 0);
 
-	GList *item = NULL;
-	for (item = g_list_first (plugin->devices); item != NULL; item = g_list_next (item)) {
-		BatteryDevice *battery_device = item->data;
+	guint i;
+	for (i = 0; i < battery_model_get_n_devices (plugin->model); i++) {
+		BatteryModelDevice *device = battery_model_get_device (plugin->model, i);
 
-		popup_window_add_device (battery_device, plugin);
+		popup_window_add_device (device->view_data, plugin);
 	}
 
 	GtkWidget *hbox = gtk_hbox_new (FALSE, 9);
@@ -705,7 +658,7 @@ popup_window_new (BatteryPlugin *plugin, GdkEventButton *event)
 
 	setup_brightness (plugin);
 
-	if (plugin->channel) {
+	if (popup_window_get_channel (plugin)) {
 		GtkWidget *separator = gtk_hseparator_new ();
 		gtk_box_pack_start (GTK_BOX (main_vbox), separator, TRUE, FALSE, 0);
 
@@ -733,12 +686,42 @@ popup_window_new (BatteryPlugin *plugin, GdkEventButton *event)
 	g_signal_connect (G_OBJECT (window), "key-press-event", G_CALLBACK (on_popup_key_press_event), plugin);
 	g_signal_connect_swapped (G_OBJECT (window), "focus-out-event", G_CALLBACK (on_popup_window_closed), plugin);
 
-	gtk_widget_show_all (window);
+	gtk_widget_show_all (main_vbox);
+
+	return window;
+}
+
+static void
+popup_window_show (BatteryPlugin *plugin)
+{
+	gint64 start = g_get_monotonic_time ();
+	guint i;
+
+	if (plugin->popup_window == NULL)
+	{
+		plugin->popup_window = popup_window_new (plugin);
+		lazy_init_mark (plugin, LAZY_INIT_POPUP, start);
+	}
+
+	/* everything that changed while we were hidden */
+	for (i = 0; i < battery_model_get_n_devices (plugin->model); i++)
+		popup_window_refresh_device (battery_model_get_device (plugin->model, i)->view_data, plugin);
+
+	update_brightness (plugin);
+
+	/* the first time this is done on realize */
+	if (gtk_widget_get_realized (plugin->popup_window))
+		on_popup_window_realized (plugin->popup_window, plugin);
+
+	gtk_widget_show (plugin->popup_window);
+
+	/* changes show up right away while the user is looking */
+	update_flush_interval (plugin);
 
 	xfce_panel_plugin_block_autohide (XFCE_PANEL_PLUGIN (plugin), TRUE);
 	gtk_toggle_button_set_active (GTK_TOGGLE_BUTTON (plugin->button), TRUE);
 
-	return window;
+	battery_histogram_add (&plugin->popup_open_time, g_get_monotonic_time () - start);
 }
 
 static gboolean
@@ -748,10 +731,10 @@ on_plugin_button_pressed (GtkWidget *widget, GdkEventButton *event, gpointer dat
 
 	if (event->button == 1 || event->button == 2) {
 		if (event->type == GDK_BUTTON_PRESS) {
-			if (plugin->popup_window != NULL) {
+			if (plugin->popup_window != NULL && gtk_widget_get_visible (plugin->popup_window)) {
 				on_popup_window_closed (plugin);
 			} else {
-				plugin->popup_window = popup_window_new (plugin, event);
+				popup_window_show (plugin);
 			}
 
 			return TRUE;
@@ -762,86 +745,223 @@ on_plugin_button_pressed (GtkWidget *widget, GdkEventButton *event, gpointer dat
 	return (*GTK_WIDGET_CLASS (battery_plugin_parent_class)->button_press_event) (GTK_WIDGET (plugin), event);
 }
 
+static void
+lazy_init_mark (BatteryPlugin *plugin, LazyInit what, gint64 start)
+{
+	plugin->lazy_init_times[what] = g_get_monotonic_time () - start;
+
+	DBG ("lazy init of %s took %" G_GINT64_FORMAT " us", lazy_init_names[what], plugin->lazy_init_times[what]);
+}
+
+static void
+startup_mark (BatteryPlugin *plugin, StartupPhase phase)
+{
+	if (plugin->startup_phases[phase] != 0)
+		return;
+
+	plugin->startup_phases[phase] = MAX (g_get_monotonic_time () - plugin->startup_time, 1);
+
+	DBG ("startup phase '%s' reached after %" G_GINT64_FORMAT " us",
+	     startup_phase_names[phase], plugin->startup_phases[phase]);
+}
+
+/* Everything that is counted or timed, as "name value" lines; startup
+ * phases that were not reached and subsystems never used are 0 */
+static gchar *
+stats_dump (BatteryPlugin *plugin)
+{
+	BatteryModelStats model_stats;
+	BatteryBrightnessStats brightness_stats = { 0, };
+	guint64 hits = 0, misses = 0;
+	GString *out;
+	gchar name[64];
+	guint i;
+
+	battery_model_get_stats (plugin->model, &model_stats);
+	battery_icon_cache_get_stats (plugin->icon_cache, &hits, &misses);
+	if (plugin->brightness)
+		battery_brightness_get_stats (plugin->brightness, &brightness_stats);
+
+	out = g_string_new (NULL);
+
+	battery_stats_append_value (out, "notifies", model_stats.n_notifies);
+	battery_stats_append_value (out, "notifies_coalesced", model_stats.n_notifies_coalesced);
+	battery_stats_append_value (out, "notifies_critical", model_stats.n_critical);
+	battery_stats_append_value (out, "flushes", model_stats.n_flushes);
+	battery_stats_append_value (out, "updates_unchanged", model_stats.n_unchanged);
+	battery_stats_append_value (out, "updates_deferred", plugin->n_popup_deferred);
+	battery_stats_append_value (out, "descriptions", plugin->n_descriptions);
+	battery_stats_append_value (out, "icon_loads", misses);
+	battery_stats_append_value (out, "icon_cache_hits", hits);
+	battery_stats_append_value (out, "brightness_writes", brightness_stats.n_writes);
+	battery_stats_append_value (out, "brightness_dropped", brightness_stats.n_dropped);
+	battery_stats_append_value (out, "helper_spawns", brightness_stats.n_spawns);
+
+	battery_stats_append_histogram (out, "update", &model_stats.update_time);
+	battery_stats_append_histogram (out, "update_latency_critical", &model_stats.critical_latency);
+	battery_stats_append_histogram (out, "update_latency_queued", &model_stats.queued_latency);
+	battery_stats_append_histogram (out, "brightness_write", &brightness_stats.latency);
+	battery_stats_append_histogram (out, "popup_open", &plugin->popup_open_time);
+
+	for (i = 0; i < N_STARTUP_PHASES; i++)
+	{
+		g_snprintf (name, sizeof (name), "startup_%s_us", startup_phase_names[i]);
+		battery_stats_append_value (out, name, plugin->startup_phases[i]);
+	}
+
+	for (i = 0; i < N_LAZY_INITS; i++)
+	{
+		g_snprintf (name, sizeof (name), "lazy_init_%s_us", lazy_init_names[i]);
+		battery_stats_append_value (out, name, plugin->lazy_init_times[i]);
+	}
+
+	return g_string_free (out, FALSE);
+}
+
+/* kill -USR1 writes the stats to $XDG_RUNTIME_DIR/battery-plugin-<id>.stats */
 static gboolean
-scan_battery (void)
+stats_signal_cb (gpointer data)
 {
-	GDir *dir;
-	gboolean ret = FALSE;
+	BatteryPlugin *plugin = BATTERY_PLUGIN (data);
+	gchar *filename, *path, *contents;
+	GError *error = NULL;
 
-	dir = g_dir_open ("/sys/class/power_supply", 0, NULL);
+	filename = g_strdup_printf ("battery-plugin-%d.stats",
+	                            xfce_panel_plugin_get_unique_id (XFCE_PANEL_PLUGIN (plugin)));
+	path = g_build_filename (g_get_user_runtime_dir (), filename, NULL);
+	contents = stats_dump (plugin);
 
-	if (dir) {
-		const gchar *entry;
-		while ((entry = g_dir_read_name (dir))) {
-			if (g_str_has_prefix (entry, "BAT")) {
-				ret = TRUE;
-				break;
-			}
-		}
+	if (!g_file_set_contents (path, contents, -1, &error))
+	{
+		g_warning ("Unable to write the stats to %s: %s", path, error->message);
+		g_error_free (error);
 	}
 
-	g_dir_close(dir);
-
-	return ret;
-	
-#if 0
-	gboolean ret = FALSE;
-	gchar *upower, *cmdline, *output = NULL;
-
-	upower = g_find_program_in_path ("upower");
-	if (upower) {
-		gchar *output = NULL;
-		gchar *cmdline = g_strdup_printf ("%s -e", upower);
-
-		if (g_spawn_command_line_sync (cmdline, &output, NULL, NULL, NULL)) {
-			if (output) {
-				guint i = 0;
-				gchar **lines = g_strsplit (output, "\n", -1);
-				for (i = 0; lines[i] != NULL; i++) {
-					if (g_strrstr (lines[i], "battery_BAT") != NULL) {
-						ret = TRUE;
-						break;
-					}
-				}
-				g_strfreev (lines);
-			}
-		}
+	g_free (contents);
+	g_free (path);
+	g_free (filename);
+
+	return TRUE;
+}
+
+static void
+supply_uevent_cb (const gchar *action, const gchar *name, gpointer data)
+{
+	BatteryPlugin *plugin = BATTERY_PLUGIN (data);
+
+	if (plugin->sysfs == NULL)
+		return;
+
+	if (g_strcmp0 (action, "change") == 0)
+		battery_sysfs_refresh (plugin->sysfs, name);
+	else
+		battery_sysfs_rescan (plugin->sysfs);
+}
+
+/* upowerd is used over GDBus by default.  BATTERY_PLUGIN_BACKEND=upower
+ * goes through libupower-glib instead, BATTERY_PLUGIN_BACKEND=mock runs
+ * the plugin without any hardware, BATTERY_PLUGIN_MOCK_DEVICES and
+ * BATTERY_PLUGIN_MOCK_RATE set how many batteries there are and how
+ * many changes per second they get */
+static BatteryBackend *
+backend_new (BatteryPlugin *plugin, const gchar *name)
+{
+	if (g_strcmp0 (name, "sysfs") == 0)
+	{
+		plugin->sysfs = battery_sysfs_new (NULL);
+
+		/* changes are picked up from the uevents the monitor gets anyway */
+		battery_supply_monitor_set_uevent_func (plugin->supply_monitor, supply_uevent_cb, plugin);
 
-		g_free (output);
-		g_free (cmdline);
+		return battery_sysfs_get_backend (plugin->sysfs);
 	}
 
-	g_free (upower);
+	if (g_strcmp0 (name, "mock") == 0)
+	{
+		BatteryMock *mock = battery_mock_new ();
+		const gchar *n_devices = g_getenv ("BATTERY_PLUGIN_MOCK_DEVICES");
+		const gchar *rate = g_getenv ("BATTERY_PLUGIN_MOCK_RATE");
 
-	return ret;
-#endif
+		battery_mock_add_batteries (mock, n_devices ? (guint) g_ascii_strtoull (n_devices, NULL, 10) : 1);
+		if (rate)
+			battery_mock_start_changes (mock, (guint) g_ascii_strtoull (rate, NULL, 10));
+
+		return battery_mock_get_backend (mock);
+	}
+
+	if (g_strcmp0 (name, "upower") == 0)
+		return battery_upower_new ();
+
+	return battery_dbus_new ();
 }
 
-static gboolean
-update_ui (gpointer data)
+static void startup_backend (BatteryPlugin *plugin, const gchar *name);
+
+static void
+backend_ready_cb (gboolean success, gpointer data)
 {
 	BatteryPlugin *plugin = BATTERY_PLUGIN (data);
 
-	if (!scan_battery ())
-		return FALSE;
+	/* Without upowerd read the power supplies ourselves; the UPower
+	 * backend is done with its call by now */
+	if (!success && plugin->sysfs == NULL)
+	{
+		g_warning ("Reading the power supplies from sysfs instead");
 
-	gtk_widget_show_all (plugin->button);
-		
-	plugin->upower = up_client_new ();
+		battery_model_remove_all (plugin->model);
+		battery_model_set_backend (plugin->model, NULL);
+		battery_backend_free (plugin->backend);
+		plugin->backend = NULL;
 
-	if (xfconf_init (NULL)) {
-		plugin->channel = xfconf_channel_get ("xfce4-power-manager");
+		startup_backend (plugin, "sysfs");
+		return;
 	}
 
-    /* Add all the devcies currently attached to the system */
-	add_all_devices (plugin);
+	startup_mark (plugin, STARTUP_PHASE_DEVICES);
+}
 
-	g_signal_connect (G_OBJECT (plugin->button), "button-press-event", G_CALLBACK (on_plugin_button_pressed), plugin);
+static void
+startup_backend (BatteryPlugin *plugin, const gchar *name)
+{
+	plugin->backend = backend_new (plugin, name);
 
-	g_signal_connect (plugin->upower, "device-added", G_CALLBACK (device_added_cb), plugin);
-	g_signal_connect (plugin->upower, "device-removed", G_CALLBACK (device_removed_cb), plugin);
+	DBG ("using the %s backend", battery_backend_get_name (plugin->backend));
 
-	return FALSE;
+	battery_model_set_backend (plugin->model, plugin->backend);
+	battery_backend_enumerate (plugin->backend, backend_ready_cb, plugin);
+}
+
+/* Nothing here waits on the backend, the tray is filled in as soon as
+ * the devices become available */
+static void
+startup (BatteryPlugin *plugin)
+{
+	startup_mark (plugin, STARTUP_PHASE_SCAN);
+
+	gtk_widget_show_all (plugin->button);
+
+	/* The backend stays running once a battery was seen */
+	if (plugin->backend)
+		return;
+
+	startup_backend (plugin, g_getenv ("BATTERY_PLUGIN_BACKEND"));
+}
+
+static void
+supply_changed_cb (gboolean has_battery, gpointer data)
+{
+	BatteryPlugin *plugin = BATTERY_PLUGIN (data);
+
+	DBG ("battery %s", has_battery ? "plugged in" : "removed");
+
+	if (has_battery) {
+		startup (plugin);
+	} else {
+		if (plugin->popup_window != NULL && gtk_widget_get_visible (plugin->popup_window))
+			on_popup_window_closed (plugin);
+
+		gtk_widget_hide (plugin->button);
+	}
 }
 
 static void
@@ -849,19 +969,51 @@ battery_plugin_free_data (XfcePanelPlugin *panel_plugin)
 {
     BatteryPlugin *plugin = BATTERY_PLUGIN (panel_plugin);
 
-	if (plugin->set_brightness_timeout) {
-		g_source_remove (plugin->set_brightness_timeout);
-		plugin->set_brightness_timeout = 0;
+#ifdef DEBUG
+	{
+		gchar *stats = stats_dump (plugin);
+		DBG ("stats:\n%s", stats);
+		g_free (stats);
 	}
+#endif
 
-    if (plugin->popup_window != NULL)
+	g_source_remove (plugin->stats_signal_id);
+
+	battery_supply_monitor_free (plugin->supply_monitor);
+	plugin->supply_monitor = NULL;
+
+    if (plugin->popup_window != NULL) {
         on_popup_window_closed (plugin);
 
-	g_free (plugin->tray_icon_name);
+        gtk_widget_destroy (plugin->popup_window);
+        plugin->popup_window = NULL;
+        plugin->scl_brightness = NULL;
+        plugin->box_devices = NULL;
+    }
+
+	battery_brightness_free (plugin->brightness);
+	plugin->brightness = NULL;
 
-	g_signal_handlers_disconnect_by_data (plugin->upower, plugin);
+	if (plugin->channel) {
+		plugin->channel = NULL;
+		xfconf_shutdown ();
+	}
+
+	/* this also stops the startup if it is still running */
+	battery_backend_free (plugin->backend);
+	plugin->backend = NULL;
+	plugin->sysfs = NULL;
+
+	/* the model tells us the tray device is gone, keep the name until then */
+	battery_model_free (plugin->model);
+	plugin->model = NULL;
+
+	g_free (plugin->tray_icon_name);
+	plugin->tray_icon_name = NULL;
 
-    remove_all_devices (plugin);
+	g_signal_handler_disconnect (gtk_icon_theme_get_default (), plugin->theme_changed_id);
+	battery_icon_cache_free (plugin->icon_cache);
+	plugin->icon_cache = NULL;
 }
 
 static gboolean
@@ -884,15 +1036,39 @@ battery_plugin_mode_changed (XfcePanelPlugin *plugin, XfcePanelPluginMode mode)
 	battery_plugin_size_changed (plugin, xfce_panel_plugin_get_size (plugin));
 }
 
+static void
+icon_theme_changed_cb (GtkIconTheme *icon_theme, BatteryPlugin *plugin)
+{
+	guint i;
+
+	if (plugin->tray_icon_name)
+		update_tray_icon (plugin);
+
+	if (plugin->popup_window == NULL)
+		return;
+
+	for (i = 0; i < battery_model_get_n_devices (plugin->model); i++)
+	{
+		BatteryDevice *battery_device = battery_model_get_device (plugin->model, i)->view_data;
+
+		if (battery_device->item_detail)
+			popup_window_update_device_icon (battery_device, plugin);
+	}
+}
+
 static void
 battery_plugin_init (BatteryPlugin *plugin)
 {
 	plugin->button         = NULL;
-	plugin->devices        = NULL;
+	plugin->model          = battery_model_new (&model_listener, plugin);
 	plugin->box_devices    = NULL;
 	plugin->popup_window   = NULL;
 	plugin->scl_brightness = NULL;
-	plugin->set_brightness_timeout = 0;
+
+	/* the rc file is only known once the plugin is constructed */
+	plugin->ac_interval = AC_FLUSH_INTERVAL;
+	plugin->battery_interval = BATTERY_FLUSH_INTERVAL;
+	update_flush_interval (plugin);
 
 	xfce_textdomain (GETTEXT_PACKAGE, PACKAGE_LOCALE_DIR, "UTF-8");
 
@@ -900,11 +1076,16 @@ battery_plugin_init (BatteryPlugin *plugin)
 	xfce_panel_plugin_add_action_widget (XFCE_PANEL_PLUGIN (plugin), plugin->button);
 	gtk_container_add (GTK_CONTAINER (plugin), plugin->button);
 
+	plugin->icon_cache = battery_icon_cache_new (gtk_icon_theme_get_default (), ICON_CACHE_SIZE);
+
+	/* the cache drops its icons first, then we load them again */
+	plugin->theme_changed_id = g_signal_connect (gtk_icon_theme_get_default (), "changed",
+	                                             G_CALLBACK (icon_theme_changed_cb), plugin);
+
 	GdkPixbuf *pix;
-	pix = gtk_icon_theme_load_icon (gtk_icon_theme_get_default (),
-                                    PANEL_DEFAULT_ICON_SYMBOLIC,
-                                    PANEL_TRAY_ICON_SIZE,
-                                    GTK_ICON_LOOKUP_FORCE_SIZE, NULL);
+	pix = battery_icon_cache_lookup (plugin->icon_cache,
+	                                 PANEL_DEFAULT_ICON_SYMBOLIC,
+	                                 PANEL_TRAY_ICON_SIZE);
 
 	if (pix) {
 		plugin->img_tray = gtk_image_new_from_pixbuf (pix);
@@ -913,7 +1094,46 @@ battery_plugin_init (BatteryPlugin *plugin)
 		g_object_unref (G_OBJECT (pix));
 	}
 
-	g_timeout_add (500, (GSourceFunc) update_ui, plugin);
+	g_signal_connect (G_OBJECT (plugin->button), "button-press-event", G_CALLBACK (on_plugin_button_pressed), plugin);
+
+	plugin->startup_time = g_get_monotonic_time ();
+
+	plugin->stats_signal_id = g_unix_signal_add (SIGUSR1, stats_signal_cb, plugin);
+
+	/* docked tablets and hot-swap packs may bring the battery later */
+	plugin->supply_monitor = battery_supply_monitor_new (supply_changed_cb, plugin);
+
+	if (battery_supply_monitor_has_battery (plugin->supply_monitor))
+		startup (plugin);
+}
+
+static void
+battery_plugin_construct (XfcePanelPlugin *panel_plugin)
+{
+	BatteryPlugin *plugin = BATTERY_PLUGIN (panel_plugin);
+	XfceRc *rc;
+	gchar *file;
+
+	/* There is no settings dialog, the intervals are only set by hand:
+	 *   [Refresh]
+	 *   ac-interval=1
+	 *   battery-interval=10 */
+	file = xfce_panel_plugin_lookup_rc_file (panel_plugin);
+	if (file == NULL)
+		return;
+
+	rc = xfce_rc_simple_open (file, TRUE);
+	g_free (file);
+
+	if (rc == NULL)
+		return;
+
+	xfce_rc_set_group (rc, "Refresh");
+	plugin->ac_interval = MAX (xfce_rc_read_int_entry (rc, "ac-interval", AC_FLUSH_INTERVAL), 0);
+	plugin->battery_interval = MAX (xfce_rc_read_int_entry (rc, "battery-interval", BATTERY_FLUSH_INTERVAL), 0);
+	xfce_rc_close (rc);
+
+	update_flush_interval (plugin);
 }
 
 static void
@@ -922,6 +1142,7 @@ battery_plugin_class_init (BatteryPluginClass *klass)
 	XfcePanelPluginClass *plugin_class;
 
 	plugin_class = XFCE_PANEL_PLUGIN_CLASS (klass);
+	plugin_class->construct = battery_plugin_construct;
 	plugin_class->free_data = battery_plugin_free_data;
 	plugin_class->size_changed = battery_plugin_size_changed;
 	plugin_class->mode_changed = battery_plugin_mode_changed;
@@ -0,0 +1,102 @@
+/*
+ *  Copyright (C) 2015-2019 Gooroom <gooroom@gooroom.kr>
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <glib.h>
+
+#include "battery-stats.h"
+
+
+void
+battery_histogram_add (BatteryHistogram *histogram, gint64 usec)
+{
+	guint bucket;
+
+	usec = MAX (usec, 0);
+
+	/* the number of bits needed, 0 us goes to the first bucket */
+	if (usec == 0)
+		bucket = 0;
+	else
+		bucket = MIN (g_bit_storage ((gulong) usec), BATTERY_HISTOGRAM_BUCKETS - 1);
+
+	histogram->buckets[bucket]++;
+	histogram->count++;
+	histogram->sum += usec;
+	histogram->max = MAX (histogram->max, usec);
+}
+
+/* The upper bound of the bucket holding the @percent-th value, good to
+ * a factor of two, or 0 if nothing was added */
+gint64
+battery_histogram_get_percentile (const BatteryHistogram *histogram, guint percent)
+{
+	guint64 rank, seen = 0;
+	guint i;
+
+	if (histogram->count == 0)
+		return 0;
+
+	rank = MAX ((histogram->count * MIN (percent, 100) + 99) / 100, 1);
+
+	for (i = 0; i < BATTERY_HISTOGRAM_BUCKETS - 1; i++)
+	{
+		seen += histogram->buckets[i];
+		if (seen >= rank)
+			return MIN ((gint64) 1 << i, histogram->max);
+	}
+
+	return histogram->max;
+}
+
+void
+battery_stats_append_value (GString *out, const gchar *name, gint64 value)
+{
+	g_string_append_printf (out, "%s %" G_GINT64_FORMAT "\n", name, value);
+}
+
+void
+battery_stats_append_histogram (GString *out, const gchar *name, const BatteryHistogram *histogram)
+{
+	guint i;
+
+	g_string_append_printf (out, "%s_count %" G_GUINT64_FORMAT "\n", name, histogram->count);
+	g_string_append_printf (out, "%s_sum_us %" G_GINT64_FORMAT "\n", name, histogram->sum);
+	g_string_append_printf (out, "%s_max_us %" G_GINT64_FORMAT "\n", name, histogram->max);
+	g_string_append_printf (out, "%s_p50_us %" G_GINT64_FORMAT "\n", name,
+	                        battery_histogram_get_percentile (histogram, 50));
+	g_string_append_printf (out, "%s_p99_us %" G_GINT64_FORMAT "\n", name,
+	                        battery_histogram_get_percentile (histogram, 99));
+
+	/* only the buckets that were hit, named by their upper bound */
+	for (i = 0; i < BATTERY_HISTOGRAM_BUCKETS; i++)
+	{
+		if (histogram->buckets[i] == 0)
+			continue;
+
+		if (i < BATTERY_HISTOGRAM_BUCKETS - 1)
+			g_string_append_printf (out, "%s_bucket_lt_%" G_GINT64_FORMAT "_us %" G_GUINT64_FORMAT "\n",
+			                        name, (gint64) 1 << i, histogram->buckets[i]);
+		else
+			g_string_append_printf (out, "%s_bucket_inf %" G_GUINT64_FORMAT "\n",
+			                        name, histogram->buckets[i]);
+	}
+}
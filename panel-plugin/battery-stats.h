@@ -0,0 +1,56 @@
+/*
+ *  Copyright (C) 2015-2019 Gooroom <gooroom@gooroom.kr>
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef __BATTERY_STATS_H__
+#define __BATTERY_STATS_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+#define BATTERY_HISTOGRAM_BUCKETS 24
+
+/* Durations in microseconds.  Bucket i counts those below 2^i us, the
+ * last one also everything longer, so adding one is a bit scan and an
+ * increment. */
+typedef struct
+{
+	guint64 count;
+	gint64  sum;
+	gint64  max;
+	guint64 buckets[BATTERY_HISTOGRAM_BUCKETS];
+} BatteryHistogram;
+
+void    battery_histogram_add             (BatteryHistogram       *histogram,
+                                           gint64                  usec);
+
+gint64  battery_histogram_get_percentile  (const BatteryHistogram *histogram,
+                                           guint                   percent);
+
+/* Dumps are "name value" lines, one per value */
+void    battery_stats_append_value        (GString                *out,
+                                           const gchar            *name,
+                                           gint64                  value);
+
+void    battery_stats_append_histogram    (GString                *out,
+                                           const gchar            *name,
+                                           const BatteryHistogram *histogram);
+
+G_END_DECLS
+
+#endif /* !__BATTERY_STATS_H__ */
@@ -0,0 +1,293 @@
+/*
+ *  Copyright (C) 2015-2019 Gooroom <gooroom@gooroom.kr>
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <linux/netlink.h>
+
+#include <glib.h>
+#include <glib-unix.h>
+
+#include <libxfce4util/libxfce4util.h>
+
+#include "battery-supply-monitor.h"
+
+
+#define POWER_SUPPLY_SYSFS_DIR  "/sys/class/power_supply"
+
+/* The multicast group the kernel sends its uevents to, udev rebroadcasts
+ * them on group 2 after its rules ran but we only need the raw ones */
+#define UEVENT_KERNEL_GROUP     (1)
+
+/* UEVENT_BUFFER_SIZE is 2048 in the kernel */
+#define UEVENT_BUFFER_SIZE      (2048)
+
+
+struct _BatterySupplyMonitor
+{
+	/* Names of the power supplies of type Battery, e.g. BAT0, CMB0
+	 * or hid-<address>-battery */
+	GHashTable        *batteries;
+
+	gint               uevent_fd;       /* -1 if netlink is not available */
+	guint              uevent_watch_id;
+
+	BatterySupplyFunc  func;
+	gpointer           user_data;
+
+	BatterySupplyUeventFunc uevent_func;
+	gpointer           uevent_data;
+};
+
+
+static gboolean
+type_is_battery (const gchar *type)
+{
+	return g_strcmp0 (type, "Battery") == 0;
+}
+
+static gboolean
+supply_is_battery (const gchar *name)
+{
+	gchar *path, *type = NULL;
+	gboolean ret = FALSE;
+
+	path = g_build_filename (POWER_SUPPLY_SYSFS_DIR, name, "type", NULL);
+	if (g_file_get_contents (path, &type, NULL, NULL))
+		ret = type_is_battery (g_strstrip (type));
+
+	g_free (type);
+	g_free (path);
+
+	return ret;
+}
+
+static void
+scan_supplies (BatterySupplyMonitor *monitor)
+{
+	const gchar *entry;
+	GDir *dir;
+
+	g_hash_table_remove_all (monitor->batteries);
+
+	dir = g_dir_open (POWER_SUPPLY_SYSFS_DIR, 0, NULL);
+	if (dir == NULL)
+		return;
+
+	while ((entry = g_dir_read_name (dir)))
+	{
+		if (supply_is_battery (entry))
+			g_hash_table_add (monitor->batteries, g_strdup (entry));
+	}
+
+	g_dir_close (dir);
+}
+
+/* A kernel uevent is "<action>@<devpath>" followed by KEY=value
+ * properties, each of them terminated by a NUL */
+static void
+handle_uevent (BatterySupplyMonitor *monitor, const gchar *buf, gsize len)
+{
+	const gchar *action = NULL, *subsystem = NULL, *devpath = NULL;
+	const gchar *name = NULL, *type = NULL;
+	const gchar *p, *end = buf + len;
+
+	for (p = buf + strnlen (buf, len) + 1; p < end; p += strnlen (p, end - p) + 1)
+	{
+		if (g_str_has_prefix (p, "ACTION="))
+			action = p + 7;
+		else if (g_str_has_prefix (p, "SUBSYSTEM="))
+			subsystem = p + 10;
+		else if (g_str_has_prefix (p, "DEVPATH="))
+			devpath = p + 8;
+		else if (g_str_has_prefix (p, "POWER_SUPPLY_NAME="))
+			name = p + 18;
+		else if (g_str_has_prefix (p, "POWER_SUPPLY_TYPE="))
+			type = p + 18;
+	}
+
+	if (action == NULL || g_strcmp0 (subsystem, "power_supply") != 0)
+		return;
+
+	/* the device directory is named after the supply */
+	if (name == NULL && devpath != NULL)
+	{
+		name = strrchr (devpath, '/');
+		name = name ? name + 1 : devpath;
+	}
+
+	if (name == NULL || *name == '\0')
+		return;
+
+	if (monitor->uevent_func)
+		monitor->uevent_func (action, name, monitor->uevent_data);
+
+	if (g_strcmp0 (action, "remove") == 0)
+	{
+		g_hash_table_remove (monitor->batteries, name);
+	}
+	else if (g_strcmp0 (action, "add") == 0 || g_strcmp0 (action, "change") == 0)
+	{
+		/* change events arrive every few seconds for each battery, the
+		 * known ones end here; the others may have been missed while
+		 * the socket overflowed */
+		if (g_hash_table_contains (monitor->batteries, name))
+			return;
+
+		if (type ? type_is_battery (type) : supply_is_battery (name))
+			g_hash_table_add (monitor->batteries, g_strdup (name));
+	}
+}
+
+static gboolean
+uevent_cb (gint fd, GIOCondition condition, gpointer data)
+{
+	BatterySupplyMonitor *monitor = data;
+	gboolean had_battery, rescan = FALSE;
+	gchar buf[UEVENT_BUFFER_SIZE + 1];
+
+	had_battery = battery_supply_monitor_has_battery (monitor);
+
+	for (;;)
+	{
+		struct sockaddr_nl sender;
+		struct iovec iov = { buf, UEVENT_BUFFER_SIZE };
+		struct msghdr msg = { 0 };
+		gssize len;
+
+		msg.msg_name = &sender;
+		msg.msg_namelen = sizeof (sender);
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+
+		len = recvmsg (fd, &msg, MSG_DONTWAIT);
+		if (len < 0)
+		{
+			if (errno == EINTR)
+				continue;
+
+			/* events were lost, find out what is there now */
+			if (errno == ENOBUFS)
+				rescan = TRUE;
+
+			break;
+		}
+
+		/* only the kernel itself is trusted */
+		if (len == 0 || sender.nl_pid != 0 || (msg.msg_flags & MSG_TRUNC))
+			continue;
+
+		buf[len] = '\0';
+		handle_uevent (monitor, buf, len);
+	}
+
+	if (rescan)
+		scan_supplies (monitor);
+
+	if (had_battery != battery_supply_monitor_has_battery (monitor) && monitor->func)
+		monitor->func (!had_battery, monitor->user_data);
+
+	return G_SOURCE_CONTINUE;
+}
+
+static gint
+open_uevent_socket (void)
+{
+	struct sockaddr_nl addr = { 0 };
+	gint fd;
+
+	fd = socket (AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, NETLINK_KOBJECT_UEVENT);
+	if (fd < 0)
+		return -1;
+
+	addr.nl_family = AF_NETLINK;
+	addr.nl_groups = UEVENT_KERNEL_GROUP;
+
+	if (bind (fd, (struct sockaddr *) &addr, sizeof (addr)) < 0)
+	{
+		close (fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+BatterySupplyMonitor *
+battery_supply_monitor_new (BatterySupplyFunc func, gpointer user_data)
+{
+	BatterySupplyMonitor *monitor;
+
+	monitor = g_new0 (BatterySupplyMonitor, 1);
+	monitor->batteries = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+	monitor->func = func;
+	monitor->user_data = user_data;
+
+	/* listen first, so nothing plugged in during the scan is missed */
+	monitor->uevent_fd = open_uevent_socket ();
+	if (monitor->uevent_fd >= 0)
+		monitor->uevent_watch_id = g_unix_fd_add (monitor->uevent_fd, G_IO_IN,
+		                                          uevent_cb, monitor);
+	else
+		g_warning ("Unable to listen for power supply uevents: %s", g_strerror (errno));
+
+	scan_supplies (monitor);
+
+	DBG ("%u batteries found, hotplug %s", g_hash_table_size (monitor->batteries),
+	     monitor->uevent_fd >= 0 ? "enabled" : "disabled");
+
+	return monitor;
+}
+
+void
+battery_supply_monitor_free (BatterySupplyMonitor *monitor)
+{
+	if (monitor == NULL)
+		return;
+
+	if (monitor->uevent_watch_id)
+		g_source_remove (monitor->uevent_watch_id);
+
+	if (monitor->uevent_fd >= 0)
+		close (monitor->uevent_fd);
+
+	g_hash_table_destroy (monitor->batteries);
+	g_free (monitor);
+}
+
+gboolean
+battery_supply_monitor_has_battery (BatterySupplyMonitor *monitor)
+{
+	return g_hash_table_size (monitor->batteries) > 0;
+}
+
+void
+battery_supply_monitor_set_uevent_func (BatterySupplyMonitor   *monitor,
+                                        BatterySupplyUeventFunc func,
+                                        gpointer                user_data)
+{
+	monitor->uevent_func = func;
+	monitor->uevent_data = user_data;
+}
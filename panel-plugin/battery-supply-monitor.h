@@ -0,0 +1,47 @@
+/*
+ *  Copyright (C) 2015-2019 Gooroom <gooroom@gooroom.kr>
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef __BATTERY_SUPPLY_MONITOR_H__
+#define __BATTERY_SUPPLY_MONITOR_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _BatterySupplyMonitor BatterySupplyMonitor;
+
+/* Called when the first battery appeared or the last one went away */
+typedef void (*BatterySupplyFunc) (gboolean has_battery, gpointer user_data);
+
+/* Called for every power supply uevent, @action is add, change or remove */
+typedef void (*BatterySupplyUeventFunc) (const gchar *action, const gchar *name, gpointer user_data);
+
+BatterySupplyMonitor *battery_supply_monitor_new         (BatterySupplyFunc     func,
+                                                          gpointer              user_data);
+
+void                  battery_supply_monitor_free        (BatterySupplyMonitor *monitor);
+
+gboolean              battery_supply_monitor_has_battery (BatterySupplyMonitor *monitor);
+
+void                  battery_supply_monitor_set_uevent_func (BatterySupplyMonitor   *monitor,
+                                                              BatterySupplyUeventFunc func,
+                                                              gpointer                user_data);
+
+G_END_DECLS
+
+#endif /* !__BATTERY_SUPPLY_MONITOR_H__ */
@@ -0,0 +1,532 @@
+/*
+ *  Copyright (C) 2015-2019 Gooroom <gooroom@gooroom.kr>
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include <libxfce4util/libxfce4util.h>
+#include <upower.h>
+
+#include "battery-sysfs.h"
+
+
+#define POWER_SUPPLY_SYSFS_DIR  "/sys/class/power_supply"
+
+/* Drivers only send a uevent when the status changes, the capacity of
+ * most ACPI batteries is picked up by this timer */
+#define SYSFS_REFRESH_INTERVAL  (30)
+
+/* A power supply uevent file is well below a page */
+#define SYSFS_UEVENT_SIZE       (4096)
+
+#define UEVENT_PREFIX           "POWER_SUPPLY_"
+
+
+typedef struct
+{
+	gchar              *name;           /* e.g. BAT0 */
+	gchar              *object_path;    /* <root>/<name> */
+	gint                fd;             /* uevent, read again for every refresh */
+	XfpmDeviceSnapshot  snapshot;
+} SysfsSupply;
+
+struct _BatterySysfs
+{
+	BatteryBackend      parent;
+
+	gchar              *root;
+	GHashTable         *supplies;       /* name to SysfsSupply */
+	guint               refresh_id;
+
+	/* Every uevent file is read into and parsed in here */
+	gchar               buf[SYSFS_UEVENT_SIZE];
+};
+
+/* The properties we use, the strings point into the parsed buffer */
+typedef struct
+{
+	const gchar *type;
+	const gchar *scope;
+	const gchar *status;
+	const gchar *manufacturer;
+	const gchar *model_name;
+	gint64       online;
+	gint64       present;
+	gint64       capacity;
+	gint64       energy_now;
+	gint64       energy_full;
+	gint64       power_now;
+	gint64       charge_now;
+	gint64       charge_full;
+	gint64       current_now;
+	gint64       time_to_empty_now;
+	gint64       time_to_full_now;
+} UeventFields;
+
+#define STRING_FIELD(key, member) { key, FALSE, G_STRUCT_OFFSET (UeventFields, member) }
+#define NUMBER_FIELD(key, member) { key, TRUE, G_STRUCT_OFFSET (UeventFields, member) }
+
+static const struct
+{
+	const gchar *key;       /* without UEVENT_PREFIX */
+	gboolean     is_number;
+	glong        offset;
+} uevent_fields[] = {
+	STRING_FIELD ("TYPE", type),
+	STRING_FIELD ("SCOPE", scope),
+	STRING_FIELD ("STATUS", status),
+	STRING_FIELD ("MANUFACTURER", manufacturer),
+	STRING_FIELD ("MODEL_NAME", model_name),
+	NUMBER_FIELD ("ONLINE", online),
+	NUMBER_FIELD ("PRESENT", present),
+	NUMBER_FIELD ("CAPACITY", capacity),
+	NUMBER_FIELD ("ENERGY_NOW", energy_now),
+	NUMBER_FIELD ("ENERGY_FULL", energy_full),
+	NUMBER_FIELD ("POWER_NOW", power_now),
+	NUMBER_FIELD ("CHARGE_NOW", charge_now),
+	NUMBER_FIELD ("CHARGE_FULL", charge_full),
+	NUMBER_FIELD ("CURRENT_NOW", current_now),
+	NUMBER_FIELD ("TIME_TO_EMPTY_NOW", time_to_empty_now),
+	NUMBER_FIELD ("TIME_TO_FULL_NOW", time_to_full_now),
+};
+
+
+static void
+parse_fields (gchar *buf, gsize len, UeventFields *fields)
+{
+	gchar *line, *end = buf + len;
+	guint i;
+
+	memset (fields, 0, sizeof (UeventFields));
+	for (i = 0; i < G_N_ELEMENTS (uevent_fields); i++)
+	{
+		if (uevent_fields[i].is_number)
+			G_STRUCT_MEMBER (gint64, fields, uevent_fields[i].offset) = -1;
+	}
+
+	/* Lines are cut in place, nothing is copied */
+	for (line = buf; line < end; )
+	{
+		gchar *eol, *eq;
+
+		eol = memchr (line, '\n', end - line);
+		if (eol == NULL)
+			eol = end;
+		*eol = '\0';
+
+		if (strncmp (line, UEVENT_PREFIX, strlen (UEVENT_PREFIX)) == 0 &&
+		    (eq = strchr (line, '=')) != NULL)
+		{
+			const gchar *key = line + strlen (UEVENT_PREFIX);
+			const gchar *value = eq + 1;
+
+			*eq = '\0';
+
+			for (i = 0; i < G_N_ELEMENTS (uevent_fields); i++)
+			{
+				if (strcmp (key, uevent_fields[i].key) != 0)
+					continue;
+
+				if (uevent_fields[i].is_number)
+					G_STRUCT_MEMBER (gint64, fields, uevent_fields[i].offset) = g_ascii_strtoll (value, NULL, 10);
+				else
+					G_STRUCT_MEMBER (const gchar *, fields, uevent_fields[i].offset) = value;
+				break;
+			}
+		}
+
+		line = eol + 1;
+	}
+}
+
+static guint
+get_state (const gchar *status)
+{
+	if (g_strcmp0 (status, "Charging") == 0)
+		return UP_DEVICE_STATE_CHARGING;
+	else if (g_strcmp0 (status, "Discharging") == 0)
+		return UP_DEVICE_STATE_DISCHARGING;
+	else if (g_strcmp0 (status, "Full") == 0)
+		return UP_DEVICE_STATE_FULLY_CHARGED;
+	else if (g_strcmp0 (status, "Not charging") == 0)
+		return UP_DEVICE_STATE_PENDING_CHARGE;
+
+	return UP_DEVICE_STATE_UNKNOWN;
+}
+
+/* The names upowerd would give the battery, see up_daemon_get_charge_icon () */
+static const gchar *
+get_battery_icon_name (guint state, gint percentage)
+{
+	static const gchar *icons[][2] = {
+		{ "battery-caution-symbolic", "battery-caution-charging-symbolic" },
+		{ "battery-low-symbolic",     "battery-low-charging-symbolic" },
+		{ "battery-good-symbolic",    "battery-good-charging-symbolic" },
+		{ "battery-full-symbolic",    "battery-full-charging-symbolic" },
+	};
+	guint level;
+
+	if (state == UP_DEVICE_STATE_EMPTY)
+		return "battery-empty-symbolic";
+	if (state == UP_DEVICE_STATE_FULLY_CHARGED)
+		return "battery-full-charged-symbolic";
+	if (state == UP_DEVICE_STATE_UNKNOWN)
+		return "battery-missing-symbolic";
+
+	level = percentage < 10 ? 0 : percentage < 30 ? 1 : percentage < 60 ? 2 : 3;
+
+	return icons[level][state == UP_DEVICE_STATE_CHARGING || state == UP_DEVICE_STATE_PENDING_CHARGE];
+}
+
+/* Seconds until @amount is used up at @rate, both in the same unit */
+static gint64
+get_time (gint64 amount, gint64 rate)
+{
+	rate = ABS (rate);
+
+	if (amount <= 0 || rate <= 0)
+		return 0;
+
+	return amount * 3600 / rate;
+}
+
+static void
+fill_battery (XfpmDeviceSnapshot *snapshot, const UeventFields *fields)
+{
+	gint64 percentage = 0, time_to_empty = 0, time_to_full = 0;
+
+	if (fields->present == 0)
+	{
+		snapshot->icon_name = g_intern_static_string ("battery-missing-symbolic");
+		return;
+	}
+
+	if (fields->capacity >= 0)
+		percentage = fields->capacity;
+	else if (fields->energy_full > 0 && fields->energy_now >= 0)
+		percentage = fields->energy_now * 100 / fields->energy_full;
+	else if (fields->charge_full > 0 && fields->charge_now >= 0)
+		percentage = fields->charge_now * 100 / fields->charge_full;
+
+	snapshot->state = get_state (fields->status);
+	snapshot->percentage = (gint) CLAMP (percentage, 0, 100);
+
+	/* Prefer what the driver estimated, then energy, then charge */
+	if (snapshot->state == UP_DEVICE_STATE_DISCHARGING)
+	{
+		if (fields->time_to_empty_now > 0)
+			time_to_empty = fields->time_to_empty_now;
+		else if (fields->energy_now >= 0 && fields->power_now > 0)
+			time_to_empty = get_time (fields->energy_now, fields->power_now);
+		else
+			time_to_empty = get_time (fields->charge_now, fields->current_now);
+	}
+	else if (snapshot->state == UP_DEVICE_STATE_CHARGING)
+	{
+		if (fields->time_to_full_now > 0)
+			time_to_full = fields->time_to_full_now;
+		else if (fields->energy_full > 0 && fields->power_now > 0)
+			time_to_full = get_time (fields->energy_full - fields->energy_now, fields->power_now);
+		else if (fields->charge_full > 0)
+			time_to_full = get_time (fields->charge_full - fields->charge_now, fields->current_now);
+	}
+
+	/* same rounding as xfpm_device_snapshot_read () */
+	snapshot->time_to_empty = time_to_empty > 0 ? (guint) ((time_to_empty + 30) / 60) : 0;
+	snapshot->time_to_full = time_to_full > 0 ? (guint) ((time_to_full + 30) / 60) : 0;
+	snapshot->icon_name = g_intern_static_string (get_battery_icon_name (snapshot->state, snapshot->percentage));
+}
+
+/**
+ * battery_sysfs_parse_uevent:
+ *
+ * Turn the contents of a power supply uevent file into a snapshot.
+ * @buf is cut into fields in place and needs room for a NUL at @len.
+ * Only vendor and model strings seen for the first time are copied,
+ * when they are interned.  Returns %FALSE for supplies that are not
+ * shown, like USB chargers.
+ **/
+gboolean
+battery_sysfs_parse_uevent (gchar *buf, gsize len, XfpmDeviceSnapshot *snapshot)
+{
+	UeventFields fields;
+
+	buf[len] = '\0';
+	parse_fields (buf, len, &fields);
+
+	memset (snapshot, 0, sizeof (XfpmDeviceSnapshot));
+	snapshot->icon_name = g_intern_static_string ("");
+	snapshot->vendor = g_intern_string (fields.manufacturer != NULL ? g_strstrip ((gchar *) fields.manufacturer) : "");
+	snapshot->model = g_intern_string (fields.model_name != NULL ? g_strstrip ((gchar *) fields.model_name) : "");
+
+	if (g_strcmp0 (fields.type, "Mains") == 0)
+	{
+		snapshot->kind = UP_DEVICE_KIND_LINE_POWER;
+		snapshot->online = fields.online > 0;
+		snapshot->icon_name = g_intern_static_string ("ac-adapter-symbolic");
+	}
+	else if (g_strcmp0 (fields.type, "Battery") == 0 || g_strcmp0 (fields.type, "UPS") == 0)
+	{
+		if (g_strcmp0 (fields.type, "UPS") == 0)
+			snapshot->kind = UP_DEVICE_KIND_UPS;
+		else if (g_strcmp0 (fields.scope, "Device") == 0)
+			/* mice, keyboards and other peripherals, never the tray */
+			snapshot->kind = UP_DEVICE_KIND_UNKNOWN;
+		else
+			snapshot->kind = UP_DEVICE_KIND_BATTERY;
+
+		fill_battery (snapshot, &fields);
+	}
+	else
+	{
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static gboolean
+supply_read (BatterySysfs *sysfs, SysfsSupply *supply, XfpmDeviceSnapshot *snapshot)
+{
+	gssize len;
+
+	/* sysfs regenerates the whole file on every read from offset 0 */
+	len = pread (supply->fd, sysfs->buf, sizeof (sysfs->buf) - 1, 0);
+	if (len <= 0)
+		return FALSE;
+
+	return battery_sysfs_parse_uevent (sysfs->buf, len, snapshot);
+}
+
+static void
+supply_free (gpointer data)
+{
+	SysfsSupply *supply = data;
+
+	if (supply->fd >= 0)
+		close (supply->fd);
+
+	g_free (supply->name);
+	g_free (supply->object_path);
+	g_free (supply);
+}
+
+static void
+supply_refresh (BatterySysfs *sysfs, SysfsSupply *supply)
+{
+	XfpmDeviceSnapshot snapshot;
+
+	if (!supply_read (sysfs, supply, &snapshot))
+		return;
+
+	if (xfpm_device_snapshot_equal (&supply->snapshot, &snapshot))
+		return;
+
+	supply->snapshot = snapshot;
+	battery_backend_emit (&sysfs->parent, BATTERY_BACKEND_CHANGED, supply->object_path);
+}
+
+static void
+supply_add (BatterySysfs *sysfs, const gchar *name)
+{
+	SysfsSupply *supply;
+	gchar *path;
+
+	supply = g_new0 (SysfsSupply, 1);
+	supply->object_path = g_build_filename (sysfs->root, name, NULL);
+
+	path = g_build_filename (supply->object_path, "uevent", NULL);
+	supply->fd = g_open (path, O_RDONLY | O_CLOEXEC, 0);
+	g_free (path);
+
+	/* not there any more, or a supply we don't show */
+	if (supply->fd < 0 || !supply_read (sysfs, supply, &supply->snapshot))
+	{
+		supply_free (supply);
+		return;
+	}
+
+	supply->name = g_strdup (name);
+	g_hash_table_insert (sysfs->supplies, supply->name, supply);
+
+	battery_backend_emit (&sysfs->parent, BATTERY_BACKEND_ADDED, supply->object_path);
+}
+
+static gboolean
+refresh_timeout_cb (gpointer data)
+{
+	battery_sysfs_refresh (data, NULL);
+
+	return G_SOURCE_CONTINUE;
+}
+
+static void
+sysfs_enumerate (BatteryBackend          *backend,
+                 BatteryBackendReadyFunc  callback,
+                 gpointer                 user_data)
+{
+	battery_sysfs_rescan ((BatterySysfs *) backend);
+
+	callback (TRUE, user_data);
+}
+
+static gboolean
+sysfs_get_snapshot (BatteryBackend     *backend,
+                    const gchar        *object_path,
+                    XfpmDeviceSnapshot *snapshot)
+{
+	BatterySysfs *sysfs = (BatterySysfs *) backend;
+	SysfsSupply *supply;
+	gsize root_len = strlen (sysfs->root);
+
+	/* the object path is <root>/<name> */
+	if (strncmp (object_path, sysfs->root, root_len) != 0 || object_path[root_len] != '/')
+		return FALSE;
+
+	supply = g_hash_table_lookup (sysfs->supplies, object_path + root_len + 1);
+	if (supply == NULL)
+		return FALSE;
+
+	*snapshot = supply->snapshot;
+
+	return TRUE;
+}
+
+static void
+sysfs_free (BatteryBackend *backend)
+{
+	BatterySysfs *sysfs = (BatterySysfs *) backend;
+
+	g_source_remove (sysfs->refresh_id);
+	g_hash_table_destroy (sysfs->supplies);
+	g_free (sysfs->root);
+	g_free (sysfs);
+}
+
+static const BatteryBackendClass sysfs_class = {
+	"sysfs",
+	sysfs_enumerate,
+	sysfs_get_snapshot,
+	NULL,
+	sysfs_free,
+};
+
+/**
+ * battery_sysfs_new:
+ * @root: the power_supply class directory, %NULL for the real one
+ *
+ * Nothing is read before the backend is enumerated.
+ **/
+BatterySysfs *
+battery_sysfs_new (const gchar *root)
+{
+	BatterySysfs *sysfs;
+
+	sysfs = g_new0 (BatterySysfs, 1);
+	sysfs->parent.klass = &sysfs_class;
+	sysfs->root = g_strdup (root != NULL ? root : POWER_SUPPLY_SYSFS_DIR);
+	sysfs->supplies = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, supply_free);
+
+	sysfs->refresh_id = g_timeout_add_seconds (SYSFS_REFRESH_INTERVAL, refresh_timeout_cb, sysfs);
+
+	return sysfs;
+}
+
+BatteryBackend *
+battery_sysfs_get_backend (BatterySysfs *sysfs)
+{
+	return &sysfs->parent;
+}
+
+/**
+ * battery_sysfs_rescan:
+ *
+ * Add the supplies that appeared and remove the ones that are gone
+ * since the last scan.
+ **/
+void
+battery_sysfs_rescan (BatterySysfs *sysfs)
+{
+	GHashTable *seen;
+	GHashTableIter iter;
+	SysfsSupply *supply;
+	const gchar *entry;
+	GDir *dir;
+
+	seen = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+	dir = g_dir_open (sysfs->root, 0, NULL);
+	if (dir)
+	{
+		while ((entry = g_dir_read_name (dir)))
+		{
+			g_hash_table_add (seen, g_strdup (entry));
+
+			if (!g_hash_table_contains (sysfs->supplies, entry))
+				supply_add (sysfs, entry);
+		}
+
+		g_dir_close (dir);
+	}
+
+	g_hash_table_iter_init (&iter, sysfs->supplies);
+	while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &supply))
+	{
+		if (g_hash_table_contains (seen, supply->name))
+			continue;
+
+		battery_backend_emit (&sysfs->parent, BATTERY_BACKEND_REMOVED, supply->object_path);
+		g_hash_table_iter_remove (&iter);
+	}
+
+	g_hash_table_destroy (seen);
+}
+
+/**
+ * battery_sysfs_refresh:
+ * @name: the supply that changed, %NULL for all of them
+ *
+ * Read the supply again and report it if anything shown changed.
+ **/
+void
+battery_sysfs_refresh (BatterySysfs *sysfs, const gchar *name)
+{
+	GHashTableIter iter;
+	SysfsSupply *supply;
+
+	if (name != NULL)
+	{
+		supply = g_hash_table_lookup (sysfs->supplies, name);
+		if (supply != NULL)
+			supply_refresh (sysfs, supply);
+		return;
+	}
+
+	g_hash_table_iter_init (&iter, sysfs->supplies);
+	while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &supply))
+		supply_refresh (sysfs, supply);
+}
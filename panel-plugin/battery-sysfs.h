@@ -0,0 +1,49 @@
+/*
+ *  Copyright (C) 2015-2019 Gooroom <gooroom@gooroom.kr>
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef __BATTERY_SYSFS_H__
+#define __BATTERY_SYSFS_H__
+
+#include <glib.h>
+
+#include "battery-backend.h"
+#include "xfpm-power-common.h"
+
+G_BEGIN_DECLS
+
+/* Reads the power supplies straight from sysfs, for systems without
+ * upowerd.  Every supply is identified by the path of its directory,
+ * which is used in place of an UPower object path. */
+typedef struct _BatterySysfs BatterySysfs;
+
+BatterySysfs   *battery_sysfs_new          (const gchar        *root);
+
+BatteryBackend *battery_sysfs_get_backend  (BatterySysfs       *sysfs);
+
+void            battery_sysfs_rescan       (BatterySysfs       *sysfs);
+
+void            battery_sysfs_refresh      (BatterySysfs       *sysfs,
+                                            const gchar        *name);
+
+gboolean        battery_sysfs_parse_uevent (gchar              *buf,
+                                            gsize               len,
+                                            XfpmDeviceSnapshot *snapshot);
+
+G_END_DECLS
+
+#endif /* !__BATTERY_SYSFS_H__ */
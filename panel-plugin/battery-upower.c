@@ -0,0 +1,364 @@
+/*
+ *  Copyright (C) 2015-2019 Gooroom <gooroom@gooroom.kr>
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <glib.h>
+#include <glib-object.h>
+#include <gio/gio.h>
+
+#include <libxfce4util/libxfce4util.h>
+#include <upower.h>
+
+#include "battery-upower.h"
+
+
+typedef struct
+{
+	BatteryBackend           parent;
+
+	UpClient                *upower;
+
+	/* Upower 0.99 has a display device that can be used for the
+	 * panel image and tooltip description */
+	UpDevice                *display_device;
+
+	/* The UpDevices indexed by the GQuark of their object path */
+	GHashTable              *devices;
+
+	/* Pending startup calls */
+	GCancellable            *cancellable;
+	guint                    idle_id;
+
+	BatteryBackendReadyFunc  ready_func;
+	gpointer                 ready_data;
+} BatteryUpower;
+
+
+/* The properties a critical change shows up in */
+static gboolean
+is_status_property (const gchar *name)
+{
+	static const gchar *names[] = { "state", "online", "percentage" };
+	guint i;
+
+	for (i = 0; i < G_N_ELEMENTS (names); i++)
+		if (g_strcmp0 (name, names[i]) == 0)
+			return TRUE;
+
+	return FALSE;
+}
+
+static void
+device_notify_cb (UpDevice *device, GParamSpec *pspec, gpointer data)
+{
+	/* UPower emits one notify per changed property, the plugin folds
+	 * them into a single refresh */
+	battery_backend_emit (data,
+	                      is_status_property (pspec->name) ? BATTERY_BACKEND_CHANGED
+	                                                       : BATTERY_BACKEND_CHANGED_DETAILS,
+	                      up_device_get_object_path (device));
+}
+
+static void
+add_device (BatteryUpower *upower, UpDevice *device)
+{
+	const gchar *object_path = up_device_get_object_path (device);
+	GQuark quark;
+
+	quark = g_quark_from_string (object_path);
+
+	/* don't add the same device twice */
+	if (g_hash_table_contains (upower->devices, GUINT_TO_POINTER (quark)))
+		return;
+
+	g_hash_table_insert (upower->devices, GUINT_TO_POINTER (quark), g_object_ref (device));
+	g_signal_connect (device, "notify", G_CALLBACK (device_notify_cb), upower);
+
+	battery_backend_emit (&upower->parent, BATTERY_BACKEND_ADDED, object_path);
+}
+
+static void
+device_added_cb (UpClient *client, UpDevice *device, gpointer data)
+{
+	add_device (data, device);
+}
+
+static void
+device_removed_cb (UpClient *client, const gchar *object_path, gpointer data)
+{
+	BatteryUpower *upower = data;
+	UpDevice *device;
+	GQuark quark;
+
+	quark = g_quark_try_string (object_path);
+	device = g_hash_table_lookup (upower->devices, GUINT_TO_POINTER (quark));
+	if (device == NULL)
+		return;
+
+	g_signal_handlers_disconnect_by_data (device, upower);
+	g_hash_table_remove (upower->devices, GUINT_TO_POINTER (quark));
+
+	battery_backend_emit (&upower->parent, BATTERY_BACKEND_REMOVED, object_path);
+}
+
+static void
+ready (BatteryUpower *upower, gboolean success)
+{
+	BatteryBackendReadyFunc func = upower->ready_func;
+
+	upower->ready_func = NULL;
+
+	if (func)
+		func (success, upower->ready_data);
+}
+
+static void
+add_devices (BatteryUpower *upower, GPtrArray *array)
+{
+	guint i;
+
+	for (i = 0; i < array->len; i++)
+		add_device (upower, g_ptr_array_index (array, i));
+
+	g_ptr_array_unref (array);
+}
+
+/* NULL when upowerd is not running.  The model takes this device over
+ * the tray whenever it shows up, so it doesn't have to come first */
+static void
+add_display_device (BatteryUpower *upower)
+{
+	upower->display_device = up_client_get_display_device (upower->upower);
+
+	if (upower->display_device)
+		add_device (upower, upower->display_device);
+}
+
+static void
+client_ready (BatteryUpower *upower, UpClient *client)
+{
+	upower->upower = client;
+
+	g_signal_connect (upower->upower, "device-added", G_CALLBACK (device_added_cb), upower);
+	g_signal_connect (upower->upower, "device-removed", G_CALLBACK (device_removed_cb), upower);
+}
+
+#if UP_CHECK_VERSION(0, 99, 14)
+/* libupower only builds the display device with a blocking call, it is
+ * left for when the devices are in */
+static gboolean
+display_device_idle (gpointer data)
+{
+	BatteryUpower *upower = data;
+
+	upower->idle_id = 0;
+
+	add_display_device (upower);
+
+	return FALSE;
+}
+
+static void
+devices_ready_cb (GObject *source, GAsyncResult *res, gpointer data)
+{
+	BatteryUpower *upower;
+	GPtrArray *array;
+	GError *error = NULL;
+
+	array = up_client_get_devices_finish (UP_CLIENT (source), res, &error);
+	if (array == NULL)
+	{
+		/* the backend is gone */
+		if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+		{
+			g_error_free (error);
+			return;
+		}
+
+		g_warning ("Unable to get the UPower devices: %s", error->message);
+		g_error_free (error);
+
+		ready (data, FALSE);
+		return;
+	}
+
+	upower = data;
+
+	add_devices (upower, array);
+	upower->idle_id = g_idle_add (display_device_idle, upower);
+
+	ready (upower, TRUE);
+}
+
+static void
+client_ready_cb (GObject *source, GAsyncResult *res, gpointer data)
+{
+	BatteryUpower *upower;
+	UpClient *client;
+	GError *error = NULL;
+
+	client = up_client_new_finish (res, &error);
+	if (client == NULL)
+	{
+		/* the backend is gone */
+		if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+		{
+			g_error_free (error);
+			return;
+		}
+
+		g_warning ("Unable to connect to UPower: %s", error->message);
+		g_error_free (error);
+
+		ready (data, FALSE);
+		return;
+	}
+
+	upower = data;
+
+	client_ready (upower, client);
+
+	up_client_get_devices_async (upower->upower, upower->cancellable,
+	                             devices_ready_cb, upower);
+}
+#else
+static gboolean
+client_sync (gpointer data)
+{
+	BatteryUpower *upower = data;
+	GPtrArray *array;
+
+	upower->idle_id = 0;
+
+	/* this libupower has no asynchronous calls yet */
+	client_ready (upower, up_client_new ());
+	add_display_device (upower);
+
+	array = up_client_get_devices (upower->upower);
+	if (array)
+		add_devices (upower, array);
+
+	ready (upower, array != NULL);
+
+	return FALSE;
+}
+#endif
+
+/* Nothing here waits on UPower, devices are reported as soon as the
+ * client and then the device list become available */
+static void
+upower_enumerate (BatteryBackend          *backend,
+                  BatteryBackendReadyFunc  callback,
+                  gpointer                 user_data)
+{
+	BatteryUpower *upower = (BatteryUpower *) backend;
+
+	upower->ready_func = callback;
+	upower->ready_data = user_data;
+
+#if UP_CHECK_VERSION(0, 99, 14)
+	up_client_new_async (upower->cancellable, client_ready_cb, upower);
+#else
+	upower->idle_id = g_idle_add (client_sync, upower);
+#endif
+}
+
+static const gchar *
+upower_get_display_device (BatteryBackend *backend)
+{
+	BatteryUpower *upower = (BatteryUpower *) backend;
+
+	if (upower->display_device == NULL)
+		return NULL;
+
+	return up_device_get_object_path (upower->display_device);
+}
+
+static gboolean
+upower_get_snapshot (BatteryBackend     *backend,
+                     const gchar        *object_path,
+                     XfpmDeviceSnapshot *snapshot)
+{
+	BatteryUpower *upower = (BatteryUpower *) backend;
+	UpDevice *device;
+
+	device = g_hash_table_lookup (upower->devices,
+	                              GUINT_TO_POINTER (g_quark_try_string (object_path)));
+	if (device == NULL)
+		return FALSE;
+
+	xfpm_device_snapshot_read (snapshot, upower_get_display_device (backend), device);
+
+	return TRUE;
+}
+
+static void
+upower_free (BatteryBackend *backend)
+{
+	BatteryUpower *upower = (BatteryUpower *) backend;
+	GHashTableIter iter;
+	UpDevice *device;
+
+	/* stop the startup if it is still running */
+	g_cancellable_cancel (upower->cancellable);
+	g_object_unref (upower->cancellable);
+
+	if (upower->idle_id)
+		g_source_remove (upower->idle_id);
+
+	g_hash_table_iter_init (&iter, upower->devices);
+	while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &device))
+		g_signal_handlers_disconnect_by_data (device, upower);
+
+	g_hash_table_destroy (upower->devices);
+
+	if (upower->display_device)
+		g_object_unref (upower->display_device);
+
+	if (upower->upower) {
+		g_signal_handlers_disconnect_by_data (upower->upower, upower);
+		g_object_unref (upower->upower);
+	}
+
+	g_free (upower);
+}
+
+static const BatteryBackendClass upower_class = {
+	"upower",
+	upower_enumerate,
+	upower_get_snapshot,
+	upower_get_display_device,
+	upower_free,
+};
+
+BatteryBackend *
+battery_upower_new (void)
+{
+	BatteryUpower *upower;
+
+	upower = g_new0 (BatteryUpower, 1);
+	upower->parent.klass = &upower_class;
+	upower->devices = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, g_object_unref);
+	upower->cancellable = g_cancellable_new ();
+
+	return &upower->parent;
+}
@@ -0,0 +1,33 @@
+/*
+ *  Copyright (C) 2015-2019 Gooroom <gooroom@gooroom.kr>
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef __BATTERY_UPOWER_H__
+#define __BATTERY_UPOWER_H__
+
+#include <glib.h>
+
+#include "battery-backend.h"
+
+G_BEGIN_DECLS
+
+/* Devices from upowerd through libupower-glib */
+BatteryBackend *battery_upower_new (void);
+
+G_END_DECLS
+
+#endif /* !__BATTERY_UPOWER_H__ */
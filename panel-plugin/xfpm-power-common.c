@@ -138,39 +138,179 @@ xfpm_battery_get_time_string (guint seconds)
     return timestring;
 }
 
-static gboolean
-is_display_device (UpClient *upower, UpDevice *device)
+/* to a whole percent */
+static gint
+round_percentage (gdouble percentage)
 {
-    UpDevice *display_device = NULL;
-    gboolean ret = FALSE;
-
-#if UP_CHECK_VERSION(0, 99, 0)
-    display_device = up_client_get_display_device (upower);
-#else
-    return FALSE;
-#endif
+    return (gint) (percentage + 0.5);
+}
 
-    ret = g_strcmp0(up_device_get_object_path(device), up_device_get_object_path(display_device)) == 0 ? TRUE : FALSE;
+/* same rounding as xfpm_battery_get_time_string () */
+static guint
+round_minutes (gint64 seconds)
+{
+    return seconds > 0 ? (guint) ((seconds + 30) / 60) : 0;
+}
 
-    g_object_unref (display_device);
+static gboolean
+is_display_device (const gchar *display_path, UpDevice *device)
+{
+    if (display_path == NULL)
+        return FALSE;
 
-    return ret;
+    return g_strcmp0 (up_device_get_object_path (device), display_path) == 0;
 }
 
-gchar*
-get_device_icon_name (UpClient *upower, UpDevice *device)
+/**
+ * xfpm_device_snapshot_read:
+ *
+ * Fetch everything the icon and description need with a single
+ * g_object_get () on the device. @display_path is the object path of
+ * UPower's composite display device, or %NULL if there is none; no D-Bus
+ * call is made.
+ **/
+void
+xfpm_device_snapshot_read (XfpmDeviceSnapshot *snapshot, const gchar *display_path, UpDevice *device)
 {
-    gchar *icon_name = NULL;
-    gchar *icon_suffix;
-    gsize icon_base_length;
-    gchar *upower_icon;
-    guint type = 0;
+    gchar *icon_name = NULL, *vendor = NULL, *model = NULL;
+    guint type = 0, state = 0;
+    gboolean online = FALSE;
+    gdouble percentage = 0;
+    gint64 time_to_empty = 0, time_to_full = 0;
 
     /* hack, this depends on XFPM_DEVICE_TYPE_* being in sync with UP_DEVICE_KIND_* */
     g_object_get (device,
                   "kind", &type,
-                  "icon-name", &upower_icon,
-                  NULL);
+                  "icon-name", &icon_name,
+                  "vendor", &vendor,
+                  "model", &model,
+                  "state", &state,
+                  "percentage", &percentage,
+                  "time-to-empty", &time_to_empty,
+                  "time-to-full", &time_to_full,
+                  "online", &online,
+                   NULL);
+
+    snapshot->kind = type;
+    snapshot->state = state;
+    snapshot->percentage = round_percentage (percentage);
+    snapshot->time_to_empty = round_minutes (time_to_empty);
+    snapshot->time_to_full = round_minutes (time_to_full);
+    snapshot->online = online;
+    snapshot->is_display = is_display_device (display_path, device);
+    snapshot->icon_name = g_intern_string (icon_name != NULL ? icon_name : "");
+    snapshot->vendor = g_intern_string (vendor != NULL ? vendor : "");
+    snapshot->model = g_intern_string (model != NULL ? model : "");
+
+    g_free (icon_name);
+    g_free (vendor);
+    g_free (model);
+}
+
+/**
+ * xfpm_device_snapshot_update:
+ *
+ * Apply one org.freedesktop.UPower.Device property, from a GetAll reply
+ * or a PropertiesChanged signal, to @snapshot.  Properties that are not
+ * part of a snapshot, or have an unexpected type, are left alone and
+ * give %XFPM_SNAPSHOT_FIELD_NONE.  is_display is not touched.
+ **/
+XfpmSnapshotField
+xfpm_device_snapshot_update (XfpmDeviceSnapshot *snapshot, const gchar *name, GVariant *value)
+{
+    /* by type first, most properties are doubles nobody shows */
+    if (g_variant_is_of_type (value, G_VARIANT_TYPE_DOUBLE))
+    {
+        if (g_strcmp0 (name, "Percentage") == 0)
+        {
+            snapshot->percentage = round_percentage (g_variant_get_double (value));
+            return XFPM_SNAPSHOT_FIELD_STATUS;
+        }
+    }
+    else if (g_variant_is_of_type (value, G_VARIANT_TYPE_UINT32))
+    {
+        if (g_strcmp0 (name, "State") == 0)
+        {
+            snapshot->state = g_variant_get_uint32 (value);
+            return XFPM_SNAPSHOT_FIELD_STATUS;
+        }
+        if (g_strcmp0 (name, "Type") == 0)
+        {
+            snapshot->kind = g_variant_get_uint32 (value);
+            return XFPM_SNAPSHOT_FIELD_DETAILS;
+        }
+    }
+    else if (g_variant_is_of_type (value, G_VARIANT_TYPE_INT64))
+    {
+        if (g_strcmp0 (name, "TimeToEmpty") == 0)
+        {
+            snapshot->time_to_empty = round_minutes (g_variant_get_int64 (value));
+            return XFPM_SNAPSHOT_FIELD_DETAILS;
+        }
+        if (g_strcmp0 (name, "TimeToFull") == 0)
+        {
+            snapshot->time_to_full = round_minutes (g_variant_get_int64 (value));
+            return XFPM_SNAPSHOT_FIELD_DETAILS;
+        }
+    }
+    else if (g_variant_is_of_type (value, G_VARIANT_TYPE_BOOLEAN))
+    {
+        if (g_strcmp0 (name, "Online") == 0)
+        {
+            snapshot->online = g_variant_get_boolean (value);
+            return XFPM_SNAPSHOT_FIELD_STATUS;
+        }
+    }
+    else if (g_variant_is_of_type (value, G_VARIANT_TYPE_STRING))
+    {
+        if (g_strcmp0 (name, "IconName") == 0)
+        {
+            snapshot->icon_name = g_intern_string (g_variant_get_string (value, NULL));
+            return XFPM_SNAPSHOT_FIELD_DETAILS;
+        }
+        if (g_strcmp0 (name, "Vendor") == 0)
+        {
+            snapshot->vendor = g_intern_string (g_variant_get_string (value, NULL));
+            return XFPM_SNAPSHOT_FIELD_DETAILS;
+        }
+        if (g_strcmp0 (name, "Model") == 0)
+        {
+            snapshot->model = g_intern_string (g_variant_get_string (value, NULL));
+            return XFPM_SNAPSHOT_FIELD_DETAILS;
+        }
+    }
+
+    return XFPM_SNAPSHOT_FIELD_NONE;
+}
+
+/**
+ * xfpm_device_snapshot_equal:
+ *
+ * Whether both snapshots render to the same icon and description.
+ **/
+gboolean
+xfpm_device_snapshot_equal (const XfpmDeviceSnapshot *a, const XfpmDeviceSnapshot *b)
+{
+    /* the strings are interned, comparing the pointers is enough */
+    return a->kind == b->kind
+        && a->state == b->state
+        && a->percentage == b->percentage
+        && a->time_to_empty == b->time_to_empty
+        && a->time_to_full == b->time_to_full
+        && a->online == b->online
+        && a->is_display == b->is_display
+        && a->icon_name == b->icon_name
+        && a->vendor == b->vendor
+        && a->model == b->model;
+}
+
+gchar*
+xfpm_device_snapshot_get_icon_name (const XfpmDeviceSnapshot *snapshot)
+{
+    const gchar *upower_icon = snapshot->icon_name;
+    const gchar *icon_suffix;
+    gsize icon_base_length;
+    guint type = snapshot->kind;
 
     /* Strip away the symbolic suffix for the device icons for the devices tab
      * and the panel plugin's menu */
@@ -189,74 +329,54 @@ get_device_icon_name (UpClient *upower, UpDevice *device)
      * because UPower doesn't return device-specific icon-names
      */
     if ( type == UP_DEVICE_KIND_UPS )
-        icon_name = g_strdup (XFPM_UPS_ICON);
+        return g_strdup (XFPM_UPS_ICON);
     else if ( type == UP_DEVICE_KIND_MOUSE )
-        icon_name = g_strdup (XFPM_MOUSE_ICON);
+        return g_strdup (XFPM_MOUSE_ICON);
     else if ( type == UP_DEVICE_KIND_KEYBOARD )
-        icon_name = g_strdup (XFPM_KBD_ICON);
+        return g_strdup (XFPM_KBD_ICON);
     else if ( type == UP_DEVICE_KIND_PHONE )
-        icon_name = g_strdup (XFPM_PHONE_ICON);
+        return g_strdup (XFPM_PHONE_ICON);
     else if ( type == UP_DEVICE_KIND_PDA )
-        icon_name = g_strdup (XFPM_PDA_ICON);
+        return g_strdup (XFPM_PDA_ICON);
     else if ( type == UP_DEVICE_KIND_MEDIA_PLAYER )
-        icon_name = g_strdup (XFPM_MEDIA_PLAYER_ICON);
+        return g_strdup (XFPM_MEDIA_PLAYER_ICON);
     else if ( type == UP_DEVICE_KIND_LINE_POWER )
-        icon_name = g_strdup (XFPM_AC_ADAPTER_ICON);
+        return g_strdup (XFPM_AC_ADAPTER_ICON);
     else if ( type == UP_DEVICE_KIND_MONITOR )
-        icon_name = g_strdup (XFPM_MONITOR_ICON);
+        return g_strdup (XFPM_MONITOR_ICON);
     else if ( type == UP_DEVICE_KIND_TABLET )
-        icon_name = g_strdup (XFPM_TABLET_ICON);
+        return g_strdup (XFPM_TABLET_ICON);
     else if ( type == UP_DEVICE_KIND_COMPUTER )
-        icon_name = g_strdup (XFPM_COMPUTER_ICON);
+        return g_strdup (XFPM_COMPUTER_ICON);
     else if ( g_strcmp0 (upower_icon, "") != 0 )
-        icon_name = g_strndup (upower_icon, icon_base_length);
+        return g_strndup (upower_icon, icon_base_length);
 
-    return icon_name;
+    return NULL;
 }
 
 gchar*
-get_device_description (UpClient *upower, UpDevice *device)
+xfpm_device_snapshot_get_description (const XfpmDeviceSnapshot *snapshot)
 {
     gchar *tip = NULL;
     gchar *est_time_str = NULL;
-    guint type = 0, state = 0;
-    gchar *model = NULL, *vendor = NULL;
-    gboolean present, online;
-    gdouble percentage;
-    guint64 time_to_empty, time_to_full;
-
-    /* hack, this depends on XFPM_DEVICE_TYPE_* being in sync with UP_DEVICE_KIND_* */
-    g_object_get (device,
-                  "kind", &type,
-                  "vendor", &vendor,
-                  "model", &model,
-                  "state", &state,
-                  "is-present", &present,
-                  "percentage", &percentage,
-                  "time-to-empty", &time_to_empty,
-                  "time-to-full", &time_to_full,
-                  "online", &online,
-                   NULL);
-
-    if (is_display_device (upower, device))
+    guint type = snapshot->kind, state = snapshot->state;
+    const gchar *model = snapshot->model, *vendor = snapshot->vendor;
+    gboolean online = snapshot->online;
+    gdouble percentage = snapshot->percentage;
+    guint time_to_empty = snapshot->time_to_empty * 60;
+    guint time_to_full = snapshot->time_to_full * 60;
+
+    if (snapshot->is_display)
     {
-        g_free (vendor);
-        vendor = g_strdup (_("Computer"));
-
-        g_free (model);
-        model = g_strdup ("");
+        vendor = _("Computer");
+        model = "";
     }
 
-    if (vendor == NULL)
-        vendor = g_strdup ("");
-    if (model == NULL)
-        model = g_strdup ("");
-
     /* If we get a vendor or model we can use it, otherwise translate the
      * device type into something readable (works for things like ac_power)
      */
     if (g_strcmp0(vendor, "") == 0 && g_strcmp0(model, "") == 0)
-        vendor = g_strdup_printf ("%s", xfpm_power_translate_device_type (type));
+        vendor = xfpm_power_translate_device_type (type);
 
     /* If the device is unknown to the kernel (maybe no-name stuff or
      * whatever), then vendor and model will have a hex ID of 31
@@ -266,10 +386,8 @@ get_device_description (UpClient *upower, UpDevice *device)
      */
     else if (strlen(vendor) == 31 && strlen(model) == 31)
     {
-        g_free (vendor);
-        g_free (model);
-        vendor = g_strdup_printf ("%s", xfpm_power_translate_device_type (type));
-        model = g_strdup("");
+        vendor = xfpm_power_translate_device_type (type);
+        model = "";
     }
 
     if ( state == UP_DEVICE_STATE_FULLY_CHARGED )
@@ -352,7 +470,7 @@ get_device_description (UpClient *upower, UpDevice *device)
             tip = g_strdup_printf (_("<b>%s %s</b>\n%s"),
                            vendor, model, online ? _("Plugged in") : _("Not plugged in"));
         }
-	else if (is_display_device (upower, device))
+	else if (snapshot->is_display)
 	{
 	    /* Desktop pc with no battery, just display the vendor and model,
 	     * which will probably just be Computer */
@@ -366,8 +484,26 @@ get_device_description (UpClient *upower, UpDevice *device)
         }
     }
 
-    g_free(model);
-    g_free(vendor);
-
     return tip;
 }
+
+gchar*
+get_device_icon_name (UpDevice *device)
+{
+    XfpmDeviceSnapshot snapshot;
+
+    /* the icon does not depend on being the display device */
+    xfpm_device_snapshot_read (&snapshot, NULL, device);
+
+    return xfpm_device_snapshot_get_icon_name (&snapshot);
+}
+
+gchar*
+get_device_description (const gchar *display_path, UpDevice *device)
+{
+    XfpmDeviceSnapshot snapshot;
+
+    xfpm_device_snapshot_read (&snapshot, display_path, device);
+
+    return xfpm_device_snapshot_get_description (&snapshot);
+}
@@ -47,14 +47,54 @@
 #define POLKIT_AUTH_SUSPEND_CONSOLEKIT2   "org.freedesktop.consolekit.system.suspend"
 #define POLKIT_AUTH_HIBERNATE_CONSOLEKIT2 "org.freedesktop.consolekit.system.hibernate"
 
+/* The part of an UpDevice that ends up on screen.  Strings are interned
+ * and values are rounded to what the description shows, so two snapshots
+ * compare equal whenever the rendered icon and text would be the same. */
+typedef struct
+{
+    guint        kind;
+    guint        state;
+    gint         percentage;     /* rounded to a whole percent */
+    guint        time_to_empty;  /* in minutes */
+    guint        time_to_full;   /* in minutes */
+    gboolean     online;
+    gboolean     is_display;     /* the composite display device */
+    const gchar *icon_name;      /* as reported by UPower */
+    const gchar *vendor;
+    const gchar *model;
+} XfpmDeviceSnapshot;
+
+/* What an org.freedesktop.UPower.Device property is to a snapshot */
+typedef enum
+{
+    XFPM_SNAPSHOT_FIELD_NONE,      /* not shown anywhere */
+    XFPM_SNAPSHOT_FIELD_STATUS,    /* state, level or power source */
+    XFPM_SNAPSHOT_FIELD_DETAILS    /* kind, icon, time estimates and names */
+} XfpmSnapshotField;
+
+void     xfpm_device_snapshot_read            (XfpmDeviceSnapshot       *snapshot,
+                                               const gchar              *display_path,
+                                               UpDevice                 *device);
+
+XfpmSnapshotField xfpm_device_snapshot_update (XfpmDeviceSnapshot     *snapshot,
+                                               const gchar              *name,
+                                               GVariant                 *value);
+
+gboolean xfpm_device_snapshot_equal           (const XfpmDeviceSnapshot *a,
+                                               const XfpmDeviceSnapshot *b);
+
+gchar   *xfpm_device_snapshot_get_icon_name   (const XfpmDeviceSnapshot *snapshot);
+
+gchar   *xfpm_device_snapshot_get_description (const XfpmDeviceSnapshot *snapshot);
+
 const gchar *xfpm_power_translate_device_type (guint type);
 
 const gchar	*xfpm_power_translate_technology (guint value);
 
 gchar *xfpm_battery_get_time_string (guint seconds);
 
-gchar *get_device_icon_name (UpClient *upower, UpDevice *device);
+gchar *get_device_icon_name (UpDevice *device);
 
-gchar *get_device_description (UpClient *upower, UpDevice *device);
+gchar *get_device_description (const gchar *display_path, UpDevice *device);
 
 #endif /* XFPM_UPOWER_COMMON */
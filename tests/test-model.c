@@ -0,0 +1,433 @@
+/*
+ *  Copyright (C) 2015-2019 Gooroom <gooroom@gooroom.kr>
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+
+
+/* BatteryModel fed by the mock backend, without a display: events
+ * folded into one refresh, the device shown in the tray and critical
+ * changes going past the queue. */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+
+#include <glib.h>
+
+#include <upower.h>
+
+#include "xfpm-power-common.h"
+#include "battery-backend.h"
+#include "battery-mock.h"
+#include "battery-model.h"
+
+
+/* Long enough that nothing is flushed unless a test asks for it */
+#define TEST_FLUSH_INTERVAL     (60)
+
+
+typedef struct
+{
+	BatteryMock    *mock;
+	BatteryBackend *backend;
+	BatteryModel   *model;
+
+	guint           n_added;
+	guint           n_changed;
+	guint           n_removed;
+	guint           n_display_changed;
+	GQuark          last_changed;   /* 0 before the first change */
+	GQuark          display_path;   /* 0 for no display device */
+} Fixture;
+
+static XfpmDeviceSnapshot
+make_snapshot (guint kind, guint state, gint percentage)
+{
+	XfpmDeviceSnapshot snapshot;
+
+	memset (&snapshot, 0, sizeof (snapshot));
+	snapshot.kind = kind;
+	snapshot.state = state;
+	snapshot.percentage = percentage;
+	snapshot.online = (kind == UP_DEVICE_KIND_LINE_POWER);
+	snapshot.icon_name = snapshot.vendor = snapshot.model = g_intern_static_string ("");
+
+	return snapshot;
+}
+
+static const gchar *
+add_battery (Fixture *fixture, gint percentage)
+{
+	XfpmDeviceSnapshot snapshot;
+
+	snapshot = make_snapshot (UP_DEVICE_KIND_BATTERY, UP_DEVICE_STATE_DISCHARGING, percentage);
+
+	return battery_mock_add_device (fixture->mock, &snapshot);
+}
+
+static void
+change_percentage (Fixture *fixture, const gchar *object_path, gint percentage)
+{
+	XfpmDeviceSnapshot snapshot;
+
+	g_assert (battery_backend_get_snapshot (fixture->backend, object_path, &snapshot));
+	snapshot.percentage = percentage;
+	g_assert (battery_mock_change_device (fixture->mock, object_path, &snapshot));
+}
+
+static void
+device_added_cb (BatteryModelDevice *device, gpointer data)
+{
+	((Fixture *) data)->n_added++;
+}
+
+static void
+device_changed_cb (BatteryModelDevice *device, gpointer data)
+{
+	Fixture *fixture = data;
+
+	fixture->n_changed++;
+	fixture->last_changed = device->object_path;
+}
+
+static void
+device_removed_cb (BatteryModelDevice *device, gpointer data)
+{
+	((Fixture *) data)->n_removed++;
+}
+
+static void
+display_changed_cb (BatteryModelDevice *device, gpointer data)
+{
+	Fixture *fixture = data;
+
+	fixture->n_display_changed++;
+	fixture->display_path = device ? device->object_path : 0;
+}
+
+static const BatteryModelListener listener = {
+	device_added_cb,
+	device_changed_cb,
+	device_removed_cb,
+	display_changed_cb,
+};
+
+static void
+ready_cb (gboolean success, gpointer data)
+{
+	*(gboolean *) data = success;
+}
+
+static void
+fixture_set_up (Fixture *fixture, gconstpointer data)
+{
+	memset (fixture, 0, sizeof (Fixture));
+
+	fixture->mock = battery_mock_new ();
+	fixture->backend = battery_mock_get_backend (fixture->mock);
+	fixture->model = battery_model_new (&listener, fixture);
+
+	battery_model_set_flush_interval (fixture->model, TEST_FLUSH_INTERVAL);
+	battery_model_set_backend (fixture->model, fixture->backend);
+}
+
+static void
+fixture_tear_down (Fixture *fixture, gconstpointer data)
+{
+	battery_model_free (fixture->model);
+	battery_backend_free (fixture->backend);
+}
+
+/* The devices added so far are reported, the mock does it synchronously */
+static void
+enumerate (Fixture *fixture)
+{
+	gboolean success = FALSE;
+
+	battery_backend_enumerate (fixture->backend, ready_cb, &success);
+	g_assert (success);
+}
+
+static void
+assert_display_device (Fixture *fixture, const gchar *object_path)
+{
+	BatteryModelDevice *device = battery_model_get_display_device (fixture->model);
+
+	if (object_path == NULL)
+	{
+		g_assert (device == NULL);
+		g_assert_cmpuint (fixture->display_path, ==, 0);
+		return;
+	}
+
+	g_assert (device != NULL);
+	g_assert_cmpstr (g_quark_to_string (device->object_path), ==, object_path);
+	g_assert_cmpstr (g_quark_to_string (fixture->display_path), ==, object_path);
+}
+
+static void
+test_coalesce (Fixture *fixture, gconstpointer data)
+{
+	BatteryModelStats stats;
+	BatteryModelDevice *device;
+	const gchar *battery;
+	gint i;
+
+	battery = add_battery (fixture, 80);
+	enumerate (fixture);
+	g_assert_cmpuint (fixture->n_added, ==, 1);
+
+	/* five changes are one refresh, and nothing before the flush */
+	for (i = 79; i >= 75; i--)
+		change_percentage (fixture, battery, i);
+
+	g_assert_cmpuint (fixture->n_changed, ==, 0);
+
+	device = battery_model_find_device (fixture->model, battery);
+	g_assert_cmpint (device->snapshot.percentage, ==, 80);
+
+	battery_model_flush (fixture->model);
+	g_assert_cmpuint (fixture->n_changed, ==, 1);
+	g_assert_cmpint (device->snapshot.percentage, ==, 75);
+
+	battery_model_get_stats (fixture->model, &stats);
+	g_assert_cmpuint (stats.n_notifies, ==, 5);
+	g_assert_cmpuint (stats.n_notifies_coalesced, ==, 4);
+	g_assert_cmpuint (stats.n_critical, ==, 0);
+	g_assert_cmpuint (stats.queued_latency.count, ==, 1);
+
+	/* nothing queued, nothing refreshed */
+	battery_model_flush (fixture->model);
+	g_assert_cmpuint (fixture->n_changed, ==, 1);
+
+	/* a change nothing shows is dropped at the flush */
+	change_percentage (fixture, battery, 75);
+	battery_model_flush (fixture->model);
+	g_assert_cmpuint (fixture->n_changed, ==, 1);
+
+	battery_model_get_stats (fixture->model, &stats);
+	g_assert_cmpuint (stats.n_unchanged, ==, 1);
+}
+
+static void
+test_display_composite (Fixture *fixture, gconstpointer data)
+{
+	const gchar *display, *full, *low;
+	guint n_display_changed;
+
+	full = add_battery (fixture, 90);
+	low = add_battery (fixture, 30);
+	display = add_battery (fixture, 60);
+	battery_mock_set_display_device (fixture->mock, display);
+
+	enumerate (fixture);
+
+	/* UPower's composite device wins over the fullest battery */
+	assert_display_device (fixture, display);
+	n_display_changed = fixture->n_display_changed;
+
+	/* the other batteries change without touching the tray */
+	change_percentage (fixture, full, 89);
+	change_percentage (fixture, low, 29);
+	battery_model_flush (fixture->model);
+	g_assert_cmpuint (fixture->n_changed, ==, 2);
+	g_assert_cmpuint (fixture->n_display_changed, ==, n_display_changed);
+
+	change_percentage (fixture, display, 59);
+	battery_model_flush (fixture->model);
+	g_assert_cmpuint (fixture->n_display_changed, ==, n_display_changed + 1);
+	assert_display_device (fixture, display);
+}
+
+static void
+test_display_highest (Fixture *fixture, gconstpointer data)
+{
+	XfpmDeviceSnapshot snapshot;
+	const gchar *first, *second;
+
+	/* neither the adapter nor a full mouse are shown in the tray */
+	snapshot = make_snapshot (UP_DEVICE_KIND_LINE_POWER, UP_DEVICE_STATE_UNKNOWN, 0);
+	battery_mock_add_device (fixture->mock, &snapshot);
+	snapshot = make_snapshot (UP_DEVICE_KIND_MOUSE, UP_DEVICE_STATE_DISCHARGING, 100);
+	battery_mock_add_device (fixture->mock, &snapshot);
+
+	first = add_battery (fixture, 40);
+	second = add_battery (fixture, 70);
+
+	enumerate (fixture);
+	assert_display_device (fixture, second);
+
+	/* the fullest battery follows the charges */
+	change_percentage (fixture, second, 30);
+	battery_model_flush (fixture->model);
+	assert_display_device (fixture, first);
+
+	change_percentage (fixture, second, 50);
+	battery_model_flush (fixture->model);
+	assert_display_device (fixture, second);
+}
+
+static void
+test_display_remove (Fixture *fixture, gconstpointer data)
+{
+	XfpmDeviceSnapshot snapshot;
+	const gchar *display, *first, *second;
+
+	snapshot = make_snapshot (UP_DEVICE_KIND_LINE_POWER, UP_DEVICE_STATE_UNKNOWN, 0);
+	battery_mock_add_device (fixture->mock, &snapshot);
+
+	first = add_battery (fixture, 40);
+	second = add_battery (fixture, 70);
+	display = add_battery (fixture, 55);
+	battery_mock_set_display_device (fixture->mock, display);
+
+	enumerate (fixture);
+	assert_display_device (fixture, display);
+
+	/* without the composite device the fullest battery takes over */
+	g_assert (battery_mock_remove_device (fixture->mock, display));
+	g_assert_cmpuint (fixture->n_removed, ==, 1);
+	assert_display_device (fixture, second);
+
+	g_assert (battery_mock_remove_device (fixture->mock, second));
+	assert_display_device (fixture, first);
+
+	/* only the adapter is left, the tray falls back to its default */
+	g_assert (battery_mock_remove_device (fixture->mock, first));
+	assert_display_device (fixture, NULL);
+	g_assert_cmpuint (battery_model_get_n_devices (fixture->model), ==, 1);
+}
+
+/* Switching backends drops every device, the tray must hear of it */
+static void
+test_display_remove_all (Fixture *fixture, gconstpointer data)
+{
+	const gchar *battery;
+
+	battery = add_battery (fixture, 60);
+	enumerate (fixture);
+	assert_display_device (fixture, battery);
+
+	battery_model_remove_all (fixture->model);
+	g_assert_cmpuint (fixture->n_removed, ==, 1);
+	g_assert_cmpuint (battery_model_get_n_devices (fixture->model), ==, 0);
+	assert_display_device (fixture, NULL);
+}
+
+/* The popup rows follow the model, a removal mustn't reorder them */
+static void
+test_remove_order (Fixture *fixture, gconstpointer data)
+{
+	const gchar *paths[4];
+	guint i;
+
+	for (i = 0; i < G_N_ELEMENTS (paths); i++)
+		paths[i] = add_battery (fixture, 20 + i);
+
+	enumerate (fixture);
+
+	g_assert (battery_mock_remove_device (fixture->mock, paths[0]));
+	g_assert_cmpuint (battery_model_get_n_devices (fixture->model), ==, 3);
+
+	for (i = 0; i < 3; i++)
+	{
+		BatteryModelDevice *device = battery_model_get_device (fixture->model, i);
+
+		g_assert_cmpstr (g_quark_to_string (device->object_path), ==, paths[i + 1]);
+		g_assert_cmpuint (device->index, ==, i);
+	}
+}
+
+static void
+test_critical (Fixture *fixture, gconstpointer data)
+{
+	XfpmDeviceSnapshot snapshot;
+	BatteryModelStats stats;
+	const gchar *battery, *adapter;
+	guint n_changed;
+
+	snapshot = make_snapshot (UP_DEVICE_KIND_LINE_POWER, UP_DEVICE_STATE_UNKNOWN, 0);
+	adapter = battery_mock_add_device (fixture->mock, &snapshot);
+	battery = add_battery (fixture, 50);
+
+	enumerate (fixture);
+
+	/* a plain change waits for the flush */
+	change_percentage (fixture, battery, 49);
+	g_assert_cmpuint (fixture->n_changed, ==, 0);
+
+	/* reaching the critical level doesn't, and takes the queued change
+	 * with it */
+	change_percentage (fixture, battery, 10);
+	g_assert_cmpuint (fixture->n_changed, ==, 1);
+	g_assert_cmpuint (fixture->last_changed, ==, g_quark_from_string (battery));
+	g_assert_cmpint (battery_model_find_device (fixture->model, battery)->snapshot.percentage, ==, 10);
+
+	battery_model_flush (fixture->model);
+	g_assert_cmpuint (fixture->n_changed, ==, 1);
+
+	/* neither does pulling the plug */
+	snapshot.online = FALSE;
+	g_assert (battery_mock_change_device (fixture->mock, adapter, &snapshot));
+	g_assert_cmpuint (fixture->n_changed, ==, 2);
+	g_assert_cmpuint (fixture->last_changed, ==, g_quark_from_string (adapter));
+
+	/* nor starting to discharge */
+	g_assert (battery_backend_get_snapshot (fixture->backend, battery, &snapshot));
+	snapshot.state = UP_DEVICE_STATE_CHARGING;
+	g_assert (battery_mock_change_device (fixture->mock, battery, &snapshot));
+	battery_model_flush (fixture->model);
+	n_changed = fixture->n_changed;
+
+	snapshot.state = UP_DEVICE_STATE_DISCHARGING;
+	g_assert (battery_mock_change_device (fixture->mock, battery, &snapshot));
+	g_assert_cmpuint (fixture->n_changed, ==, n_changed + 1);
+
+	/* plugging back in is not critical */
+	snapshot = make_snapshot (UP_DEVICE_KIND_LINE_POWER, UP_DEVICE_STATE_UNKNOWN, 0);
+	g_assert (battery_mock_change_device (fixture->mock, adapter, &snapshot));
+	g_assert_cmpuint (fixture->n_changed, ==, n_changed + 1);
+
+	battery_model_get_stats (fixture->model, &stats);
+	g_assert_cmpuint (stats.n_critical, ==, 3);
+	g_assert_cmpuint (stats.critical_latency.count, ==, 3);
+}
+
+int
+main (int argc, char **argv)
+{
+	g_test_init (&argc, &argv, NULL);
+
+	g_test_add ("/model/coalesce", Fixture, NULL,
+	            fixture_set_up, test_coalesce, fixture_tear_down);
+	g_test_add ("/model/display/composite", Fixture, NULL,
+	            fixture_set_up, test_display_composite, fixture_tear_down);
+	g_test_add ("/model/display/highest", Fixture, NULL,
+	            fixture_set_up, test_display_highest, fixture_tear_down);
+	g_test_add ("/model/display/remove", Fixture, NULL,
+	            fixture_set_up, test_display_remove, fixture_tear_down);
+	g_test_add ("/model/display/remove-all", Fixture, NULL,
+	            fixture_set_up, test_display_remove_all, fixture_tear_down);
+	g_test_add ("/model/remove-order", Fixture, NULL,
+	            fixture_set_up, test_remove_order, fixture_tear_down);
+	g_test_add ("/model/critical", Fixture, NULL,
+	            fixture_set_up, test_critical, fixture_tear_down);
+
+	return g_test_run ();
+}
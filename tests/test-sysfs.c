@@ -0,0 +1,489 @@
+/*
+ *  Copyright (C) 2015-2019 Gooroom <gooroom@gooroom.kr>
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+
+
+/* The sysfs backend against a power_supply directory made up in a
+ * temporary directory: uevent parsing, icon names and supplies coming
+ * and going. */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <string.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include <upower.h>
+
+#include "xfpm-power-common.h"
+#include "battery-backend.h"
+#include "battery-sysfs.h"
+
+
+#define BATTERY_UEVENT \
+	"POWER_SUPPLY_NAME=BAT0\n" \
+	"POWER_SUPPLY_TYPE=Battery\n" \
+	"POWER_SUPPLY_STATUS=Discharging\n" \
+	"POWER_SUPPLY_PRESENT=1\n" \
+	"POWER_SUPPLY_CAPACITY=55\n" \
+	"POWER_SUPPLY_ENERGY_NOW=20000000\n" \
+	"POWER_SUPPLY_ENERGY_FULL=40000000\n" \
+	"POWER_SUPPLY_POWER_NOW=10000000\n" \
+	"POWER_SUPPLY_MANUFACTURER= SMP \n" \
+	"POWER_SUPPLY_MODEL_NAME=5B10W13930\n"
+
+#define MAINS_UEVENT \
+	"POWER_SUPPLY_NAME=AC\n" \
+	"POWER_SUPPLY_TYPE=Mains\n" \
+	"POWER_SUPPLY_ONLINE=1\n"
+
+#define PERIPHERAL_UEVENT \
+	"POWER_SUPPLY_NAME=hidpp_battery_0\n" \
+	"POWER_SUPPLY_TYPE=Battery\n" \
+	"POWER_SUPPLY_SCOPE=Device\n" \
+	"POWER_SUPPLY_STATUS=Discharging\n" \
+	"POWER_SUPPLY_CAPACITY=80\n" \
+	"POWER_SUPPLY_MODEL_NAME=MX Master 3\n"
+
+#define USB_UEVENT \
+	"POWER_SUPPLY_NAME=ucsi-source-psy-USBC000:001\n" \
+	"POWER_SUPPLY_TYPE=USB\n" \
+	"POWER_SUPPLY_ONLINE=0\n"
+
+
+/* @text is copied, the parser cuts its buffer in place */
+static gboolean
+parse (const gchar *text, XfpmDeviceSnapshot *snapshot)
+{
+	gchar *buf = g_strdup (text);
+	gboolean shown;
+
+	shown = battery_sysfs_parse_uevent (buf, strlen (buf), snapshot);
+	g_free (buf);
+
+	return shown;
+}
+
+static void
+test_parse_capacity (void)
+{
+	XfpmDeviceSnapshot snapshot;
+
+	g_assert (parse (BATTERY_UEVENT, &snapshot));
+
+	/* CAPACITY wins over the 50 % the energy files give */
+	g_assert_cmpuint (snapshot.kind, ==, UP_DEVICE_KIND_BATTERY);
+	g_assert_cmpuint (snapshot.state, ==, UP_DEVICE_STATE_DISCHARGING);
+	g_assert_cmpint (snapshot.percentage, ==, 55);
+	g_assert_cmpuint (snapshot.time_to_empty, ==, 120);
+	g_assert_cmpuint (snapshot.time_to_full, ==, 0);
+	g_assert_cmpstr (snapshot.icon_name, ==, "battery-good-symbolic");
+	g_assert_cmpstr (snapshot.vendor, ==, "SMP");
+	g_assert_cmpstr (snapshot.model, ==, "5B10W13930");
+}
+
+static void
+test_parse_energy (void)
+{
+	XfpmDeviceSnapshot snapshot;
+
+	g_assert_true (parse ("POWER_SUPPLY_TYPE=Battery\n"
+	                      "POWER_SUPPLY_STATUS=Charging\n"
+	                      "POWER_SUPPLY_ENERGY_NOW=10000000\n"
+	                      "POWER_SUPPLY_ENERGY_FULL=40000000\n"
+	                      "POWER_SUPPLY_POWER_NOW=15000000\n",
+	                      &snapshot));
+
+	g_assert_cmpuint (snapshot.state, ==, UP_DEVICE_STATE_CHARGING);
+	g_assert_cmpint (snapshot.percentage, ==, 25);
+	g_assert_cmpuint (snapshot.time_to_empty, ==, 0);
+	g_assert_cmpuint (snapshot.time_to_full, ==, 120);
+	g_assert_cmpstr (snapshot.icon_name, ==, "battery-low-charging-symbolic");
+	g_assert_cmpstr (snapshot.vendor, ==, "");
+}
+
+static void
+test_parse_charge (void)
+{
+	XfpmDeviceSnapshot snapshot;
+
+	/* µAh and µA instead of µWh and µW */
+	g_assert_true (parse ("POWER_SUPPLY_TYPE=Battery\n"
+	                      "POWER_SUPPLY_STATUS=Discharging\n"
+	                      "POWER_SUPPLY_CHARGE_NOW=300000\n"
+	                      "POWER_SUPPLY_CHARGE_FULL=4000000\n"
+	                      "POWER_SUPPLY_CURRENT_NOW=1200000\n",
+	                      &snapshot));
+
+	g_assert_cmpuint (snapshot.state, ==, UP_DEVICE_STATE_DISCHARGING);
+	g_assert_cmpint (snapshot.percentage, ==, 7);
+	g_assert_cmpuint (snapshot.time_to_empty, ==, 15);
+	g_assert_cmpstr (snapshot.icon_name, ==, "battery-caution-symbolic");
+}
+
+static void
+test_parse_mains (void)
+{
+	XfpmDeviceSnapshot snapshot;
+
+	g_assert (parse (MAINS_UEVENT, &snapshot));
+	g_assert_cmpuint (snapshot.kind, ==, UP_DEVICE_KIND_LINE_POWER);
+	g_assert (snapshot.online);
+	g_assert_cmpstr (snapshot.icon_name, ==, "ac-adapter-symbolic");
+
+	g_assert (parse ("POWER_SUPPLY_TYPE=Mains\nPOWER_SUPPLY_ONLINE=0\n", &snapshot));
+	g_assert (!snapshot.online);
+}
+
+static void
+test_parse_peripheral (void)
+{
+	XfpmDeviceSnapshot snapshot;
+
+	/* shown in the popup, but never as the tray's battery */
+	g_assert (parse (PERIPHERAL_UEVENT, &snapshot));
+	g_assert_cmpuint (snapshot.kind, ==, UP_DEVICE_KIND_UNKNOWN);
+	g_assert_cmpint (snapshot.percentage, ==, 80);
+	g_assert_cmpstr (snapshot.model, ==, "MX Master 3");
+
+	g_assert (parse ("POWER_SUPPLY_TYPE=UPS\nPOWER_SUPPLY_CAPACITY=90\n", &snapshot));
+	g_assert_cmpuint (snapshot.kind, ==, UP_DEVICE_KIND_UPS);
+
+	g_assert (!parse (USB_UEVENT, &snapshot));
+	g_assert (!parse ("", &snapshot));
+}
+
+static void
+test_parse_icons (void)
+{
+	static const struct
+	{
+		const gchar *status;
+		gint         capacity;
+		const gchar *icon_name;
+	} cases[] = {
+		{ "Discharging",    5, "battery-caution-symbolic" },
+		{ "Discharging",   29, "battery-low-symbolic" },
+		{ "Discharging",   30, "battery-good-symbolic" },
+		{ "Discharging",   60, "battery-full-symbolic" },
+		{ "Charging",       9, "battery-caution-charging-symbolic" },
+		{ "Charging",      59, "battery-good-charging-symbolic" },
+		{ "Not charging",  95, "battery-full-charging-symbolic" },
+		{ "Full",         100, "battery-full-charged-symbolic" },
+		{ "Unknown",       50, "battery-missing-symbolic" },
+	};
+	XfpmDeviceSnapshot snapshot;
+	guint i;
+
+	for (i = 0; i < G_N_ELEMENTS (cases); i++)
+	{
+		gchar *text = g_strdup_printf ("POWER_SUPPLY_TYPE=Battery\n"
+		                               "POWER_SUPPLY_STATUS=%s\n"
+		                               "POWER_SUPPLY_CAPACITY=%i\n",
+		                               cases[i].status, cases[i].capacity);
+
+		g_assert (parse (text, &snapshot));
+		g_assert_cmpstr (snapshot.icon_name, ==, cases[i].icon_name);
+		g_free (text);
+	}
+
+	g_assert (parse ("POWER_SUPPLY_TYPE=Battery\nPOWER_SUPPLY_PRESENT=0\n", &snapshot));
+	g_assert_cmpstr (snapshot.icon_name, ==, "battery-missing-symbolic");
+}
+
+
+/*
+ * A fake /sys/class/power_supply
+ */
+
+typedef struct
+{
+	gchar          *root;
+	BatterySysfs   *sysfs;
+	BatteryBackend *backend;
+	GPtrArray      *events;     /* "added BAT0" and the like */
+} Fixture;
+
+/* Rewritten in place: the backend keeps each uevent file open and reads
+ * it again from the start, like sysfs regenerates it */
+static void
+write_supply (Fixture *fixture, const gchar *name, const gchar *uevent)
+{
+	gchar *dir, *path;
+	FILE *file;
+
+	dir = g_build_filename (fixture->root, name, NULL);
+	g_assert_cmpint (g_mkdir_with_parents (dir, 0755), ==, 0);
+
+	path = g_build_filename (dir, "uevent", NULL);
+	file = g_fopen (path, "w");
+	g_assert (file != NULL);
+	fputs (uevent, file);
+	fclose (file);
+
+	g_free (path);
+	g_free (dir);
+}
+
+static void
+remove_supply (Fixture *fixture, const gchar *name)
+{
+	gchar *dir, *path;
+
+	dir = g_build_filename (fixture->root, name, NULL);
+	path = g_build_filename (dir, "uevent", NULL);
+
+	g_assert_cmpint (g_unlink (path), ==, 0);
+	g_assert_cmpint (g_rmdir (dir), ==, 0);
+
+	g_free (path);
+	g_free (dir);
+}
+
+static void
+backend_event_cb (BatteryBackendEvent event, const gchar *object_path, gpointer data)
+{
+	static const gchar *names[] = { "added", "changed", "changed-details", "removed" };
+	Fixture *fixture = data;
+	gchar *name = g_path_get_basename (object_path);
+
+	g_ptr_array_add (fixture->events, g_strdup_printf ("%s %s", names[event], name));
+	g_free (name);
+}
+
+static void
+ready_cb (gboolean success, gpointer data)
+{
+	*(gboolean *) data = success;
+}
+
+static gint
+compare_events (gconstpointer a, gconstpointer b)
+{
+	return g_strcmp0 (*(const gchar **) a, *(const gchar **) b);
+}
+
+/* Every event since the last call, sorted since directory order isn't
+ * defined, as one string */
+static gchar *
+take_events (Fixture *fixture)
+{
+	gchar *events;
+
+	g_ptr_array_sort (fixture->events, compare_events);
+	g_ptr_array_add (fixture->events, NULL);
+	events = g_strjoinv (", ", (gchar **) fixture->events->pdata);
+	g_ptr_array_set_size (fixture->events, 0);
+
+	return events;
+}
+
+static gboolean
+get_snapshot (Fixture *fixture, const gchar *name, XfpmDeviceSnapshot *snapshot)
+{
+	gchar *path = g_build_filename (fixture->root, name, NULL);
+	gboolean found;
+
+	found = battery_backend_get_snapshot (fixture->backend, path, snapshot);
+	g_free (path);
+
+	return found;
+}
+
+static void
+fixture_set_up (Fixture *fixture, gconstpointer data)
+{
+	fixture->root = g_dir_make_tmp ("battery-sysfs-XXXXXX", NULL);
+	g_assert (fixture->root != NULL);
+
+	fixture->events = g_ptr_array_new_with_free_func (g_free);
+}
+
+static void
+fixture_tear_down (Fixture *fixture, gconstpointer data)
+{
+	GPtrArray *names = g_ptr_array_new_with_free_func (g_free);
+	const gchar *name;
+	GDir *dir;
+	guint i;
+
+	battery_backend_free (fixture->backend);
+
+	dir = g_dir_open (fixture->root, 0, NULL);
+	while ((name = g_dir_read_name (dir)) != NULL)
+		g_ptr_array_add (names, g_strdup (name));
+	g_dir_close (dir);
+
+	for (i = 0; i < names->len; i++)
+		remove_supply (fixture, g_ptr_array_index (names, i));
+	g_ptr_array_unref (names);
+
+	g_rmdir (fixture->root);
+	g_free (fixture->root);
+	g_ptr_array_unref (fixture->events);
+}
+
+static void
+enumerate (Fixture *fixture)
+{
+	gboolean success = FALSE;
+
+	fixture->sysfs = battery_sysfs_new (fixture->root);
+	fixture->backend = battery_sysfs_get_backend (fixture->sysfs);
+	battery_backend_subscribe (fixture->backend, backend_event_cb, fixture);
+
+	/* sysfs is read synchronously */
+	battery_backend_enumerate (fixture->backend, ready_cb, &success);
+	g_assert (success);
+}
+
+static void
+test_enumerate (Fixture *fixture, gconstpointer data)
+{
+	XfpmDeviceSnapshot snapshot;
+	gchar *events;
+
+	write_supply (fixture, "BAT0", BATTERY_UEVENT);
+	write_supply (fixture, "AC", MAINS_UEVENT);
+	write_supply (fixture, "hidpp_battery_0", PERIPHERAL_UEVENT);
+	write_supply (fixture, "ucsi-source-psy-USBC000:001", USB_UEVENT);
+
+	enumerate (fixture);
+
+	/* the USB charger is not shown */
+	events = take_events (fixture);
+	g_assert_cmpstr (events, ==, "added AC, added BAT0, added hidpp_battery_0");
+	g_free (events);
+
+	g_assert (get_snapshot (fixture, "BAT0", &snapshot));
+	g_assert_cmpuint (snapshot.kind, ==, UP_DEVICE_KIND_BATTERY);
+	g_assert_cmpint (snapshot.percentage, ==, 55);
+
+	g_assert (get_snapshot (fixture, "AC", &snapshot));
+	g_assert_cmpuint (snapshot.kind, ==, UP_DEVICE_KIND_LINE_POWER);
+
+	g_assert (!get_snapshot (fixture, "ucsi-source-psy-USBC000:001", &snapshot));
+	g_assert (!battery_backend_get_snapshot (fixture->backend, "/sys/class/power_supply/BAT0", &snapshot));
+
+	/* sysfs has no composite device */
+	g_assert (battery_backend_get_display_device (fixture->backend) == NULL);
+}
+
+static void
+test_refresh (Fixture *fixture, gconstpointer data)
+{
+	XfpmDeviceSnapshot snapshot;
+	gchar *events, *uevent;
+
+	write_supply (fixture, "BAT0", BATTERY_UEVENT);
+	write_supply (fixture, "AC", MAINS_UEVENT);
+	enumerate (fixture);
+	g_ptr_array_set_size (fixture->events, 0);
+
+	/* nothing shown changed */
+	battery_sysfs_refresh (fixture->sysfs, NULL);
+	g_assert_cmpuint (fixture->events->len, ==, 0);
+
+	uevent = g_strconcat (BATTERY_UEVENT, "POWER_SUPPLY_CAPACITY=54\n", NULL);
+	write_supply (fixture, "BAT0", uevent);
+	write_supply (fixture, "AC", "POWER_SUPPLY_TYPE=Mains\nPOWER_SUPPLY_ONLINE=0\n");
+	g_free (uevent);
+
+	/* only the supply asked for is read */
+	battery_sysfs_refresh (fixture->sysfs, "BAT0");
+	events = take_events (fixture);
+	g_assert_cmpstr (events, ==, "changed BAT0");
+	g_free (events);
+
+	g_assert (get_snapshot (fixture, "BAT0", &snapshot));
+	g_assert_cmpint (snapshot.percentage, ==, 54);
+
+	battery_sysfs_refresh (fixture->sysfs, NULL);
+	events = take_events (fixture);
+	g_assert_cmpstr (events, ==, "changed AC");
+	g_free (events);
+
+	g_assert (get_snapshot (fixture, "AC", &snapshot));
+	g_assert (!snapshot.online);
+
+	/* unknown names are ignored */
+	battery_sysfs_refresh (fixture->sysfs, "BAT9");
+	g_assert_cmpuint (fixture->events->len, ==, 0);
+}
+
+static void
+test_add_remove (Fixture *fixture, gconstpointer data)
+{
+	XfpmDeviceSnapshot snapshot;
+	gchar *events;
+
+	write_supply (fixture, "BAT0", BATTERY_UEVENT);
+	write_supply (fixture, "AC", MAINS_UEVENT);
+	enumerate (fixture);
+	g_ptr_array_set_size (fixture->events, 0);
+
+	/* a second battery is plugged in and the adapter goes away */
+	write_supply (fixture, "BAT1", BATTERY_UEVENT);
+	remove_supply (fixture, "AC");
+	battery_sysfs_rescan (fixture->sysfs);
+
+	events = take_events (fixture);
+	g_assert_cmpstr (events, ==, "added BAT1, removed AC");
+	g_free (events);
+
+	g_assert (get_snapshot (fixture, "BAT1", &snapshot));
+	g_assert (!get_snapshot (fixture, "AC", &snapshot));
+
+	/* nothing new */
+	battery_sysfs_rescan (fixture->sysfs);
+	g_assert_cmpuint (fixture->events->len, ==, 0);
+
+	remove_supply (fixture, "BAT0");
+	remove_supply (fixture, "BAT1");
+	battery_sysfs_rescan (fixture->sysfs);
+
+	events = take_events (fixture);
+	g_assert_cmpstr (events, ==, "removed BAT0, removed BAT1");
+	g_free (events);
+}
+
+int
+main (int argc, char **argv)
+{
+	g_test_init (&argc, &argv, NULL);
+
+	g_test_add_func ("/sysfs/parse/capacity", test_parse_capacity);
+	g_test_add_func ("/sysfs/parse/energy", test_parse_energy);
+	g_test_add_func ("/sysfs/parse/charge", test_parse_charge);
+	g_test_add_func ("/sysfs/parse/mains", test_parse_mains);
+	g_test_add_func ("/sysfs/parse/peripheral", test_parse_peripheral);
+	g_test_add_func ("/sysfs/parse/icons", test_parse_icons);
+
+	g_test_add ("/sysfs/backend/enumerate", Fixture, NULL,
+	            fixture_set_up, test_enumerate, fixture_tear_down);
+	g_test_add ("/sysfs/backend/refresh", Fixture, NULL,
+	            fixture_set_up, test_refresh, fixture_tear_down);
+	g_test_add ("/sysfs/backend/add-remove", Fixture, NULL,
+	            fixture_set_up, test_add_remove, fixture_tear_down);
+
+	return g_test_run ();
+}